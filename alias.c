@@ -47,31 +47,28 @@ static char sccsid[] = "@(#)alias.c	8.3 (Berkeley) 5/4/95";
 #include "mystring.h"
 #include "alias.h"
 #include "options.h"	/* XXX for argptr (should remove?) */
+#include "hashtab.h"
 
-#define ATABSIZE 39
+STATIC int aliasmatch __P((void *, const char *));
 
-struct alias *atab[ATABSIZE];
+struct hashtab atab = { aliasmatch };
 
 STATIC void setalias __P((char *, char *));
 STATIC int unalias __P((char *));
-STATIC struct alias **hashalias __P((char *));
 
 STATIC
 void
 setalias(name, val)
 	char *name, *val;
 {
-	struct alias *ap, **app;
+	struct alias *ap;
 
-	app = hashalias(name);
-	for (ap = *app; ap; ap = ap->next) {
-		if (equal(name, ap->name)) {
-			INTOFF;
-			ckfree(ap->val);
-			ap->val	= savestr(val);
-			INTON;
-			return;
-		}
+	if ((ap = lookupalias(name, 0)) != NULL) {
+		INTOFF;
+		ckfree(ap->val);
+		ap->val	= savestr(val);
+		INTON;
+		return;
 	}
 	/* not found */
 	INTOFF;
@@ -105,8 +102,7 @@ setalias(name, val)
 	ap->val[len+1] = '\0';
 	}
 #endif
-	ap->next = *app;
-	*app = ap;
+	htadd(&atab, ap, hashstr(name));
 	INTON;
 }
 
@@ -114,34 +110,30 @@ STATIC int
 unalias(name)
 	char *name;
 	{
-	struct alias *ap, **app;
-
-	app = hashalias(name);
+	struct alias *ap;
+	struct hashent *hp;
 
-	for (ap = *app; ap; app = &(ap->next), ap = ap->next) {
-		if (equal(name, ap->name)) {
-			/*
-			 * if the alias is currently in use (i.e. its
-			 * buffer is being used by the input routine) we
-			 * just null out the name instead of freeing it.
-			 * We could clear it out later, but this situation
-			 * is so rare that it hardly seems worth it.
-			 */
-			if (ap->flag & ALIASINUSE)
-				*ap->name = '\0';
-			else {
-				INTOFF;
-				*app = ap->next;
-				ckfree(ap->name);
-				ckfree(ap->val);
-				ckfree(ap);
-				INTON;
-			}
-			return (0);
-		}
+	if ((hp = htlookup(&atab, name, hashstr(name))) == NULL)
+		return (1);
+	ap = hp->ent;
+	/*
+	 * if the alias is currently in use (i.e. its
+	 * buffer is being used by the input routine) we
+	 * just null out the name instead of freeing it.
+	 * We could clear it out later, but this situation
+	 * is so rare that it hardly seems worth it.
+	 */
+	if (ap->flag & ALIASINUSE)
+		*ap->name = '\0';
+	else {
+		INTOFF;
+		htdelete(&atab, hp);
+		ckfree(ap->name);
+		ckfree(ap->val);
+		ckfree(ap);
+		INTON;
 	}
-
-	return (1);
+	return (0);
 }
 
 #ifdef mkinit
@@ -154,21 +146,17 @@ SHELLPROC {
 
 void
 rmaliases() {
-	struct alias *ap, *tmp;
-	int i;
+	struct alias *ap;
+	struct hashent *hp;
 
 	INTOFF;
-	for (i = 0; i < ATABSIZE; i++) {
-		ap = atab[i];
-		atab[i] = NULL;
-		while (ap) {
-			ckfree(ap->name);
-			ckfree(ap->val);
-			tmp = ap;
-			ap = ap->next;
-			ckfree(tmp);
-		}
+	HTFOREACH(hp, &atab) {
+		ap = hp->ent;
+		ckfree(ap->name);
+		ckfree(ap->val);
+		ckfree(ap);
 	}
+	htclear(&atab);
 	INTON;
 }
 
@@ -177,17 +165,15 @@ lookupalias(name, check)
 	char *name;
 	int check;
 {
-	struct alias *ap = *hashalias(name);
-
-	for (; ap; ap = ap->next) {
-		if (equal(name, ap->name)) {
-			if (check && (ap->flag & ALIASINUSE))
-				return (NULL);
-			return (ap);
-		}
-	}
+	struct hashent *hp;
+	struct alias *ap;
 
-	return (NULL);
+	if ((hp = htlookup(&atab, name, hashstr(name))) == NULL)
+		return (NULL);
+	ap = hp->ent;
+	if (check && (ap->flag & ALIASINUSE))
+		return (NULL);
+	return (ap);
 }
 
 /*
@@ -203,13 +189,13 @@ aliascmd(argc, argv)
 	struct alias *ap;
 
 	if (argc == 1) {
-		int i;
+		struct hashent *hp;
 
-		for (i = 0; i < ATABSIZE; i++)
-			for (ap = atab[i]; ap; ap = ap->next) {
-				if (*ap->name != '\0')
-				    out1fmt("alias %s=%s\n", ap->name, ap->val);
-			}
+		HTFOREACH(hp, &atab) {
+			ap = hp->ent;
+			if (*ap->name != '\0')
+			    out1fmt("alias %s=%s\n", ap->name, ap->val);
+		}
 		return (0);
 	}
 	while ((n = *++argv) != NULL) {
@@ -247,14 +233,10 @@ unaliascmd(argc, argv)
 	return (i);
 }
 
-STATIC struct alias **
-hashalias(p)
-	register char *p;
+STATIC int
+aliasmatch(ent, name)
+	void *ent;
+	const char *name;
 	{
-	unsigned int hashval;
-
-	hashval = *p << 4;
-	while (*p)
-		hashval+= *p++;
-	return &atab[hashval % ATABSIZE];
+	return equal(((struct alias *)ent)->name, name);
 }
@@ -39,7 +39,6 @@
 #define ALIASINUSE	1
 
 struct alias {
-	struct alias *next;
 	char *name;
 	char *val;
 	int flag;
@@ -37,302 +37,1138 @@
  */
 
 #include <stdlib.h>
-#include <ctype.h>
+#include <string.h>
 
 #include "shell.h"
 #include "arith.h"
+#include "syntax.h"
+#include "nodes.h"
 #include "error.h"
 #include "output.h"
 #include "memalloc.h"
+#include "machdep.h"
 #include "expand.h"
 #include "var.h"
+#include "hashtab.h"
+#include "options.h"
 
-char *arith_buf, *arith_startbuf;
+/*
+ * Expressions are compiled by a recursive-descent parser into postfix
+ * code for a small stack machine, which is what gets run.  Operator
+ * precedence (low to high):
+ *   ,  = op=  ?:  ||  &&  |  ^  &  == !=  < > <= >=  << >>  + -
+ *   * / %  **  unary (! ~ - + ++ --)  postfix (++ --)
+ * Arithmetic is done in arith_t, with wraparound on overflow.
+ *
+ * Compiled programs are kept in a small cache, looked up by the text
+ * of the expression.  A (( )) command also remembers the cache slot of
+ * its program, so a loop does not even look up the text.
+ */
+
+typedef unsigned long long uarith_t;	/* for arithmetic that wraps */
+
+/* tokens */
+#define A_END		0
+#define A_NUM		1	/* number, in ar.val */
+#define A_VAR		2	/* variable, ar.name and ar.namelen */
+#define A_ASSIGN	3	/* = or op=, with the op in ar.op */
+#define A_LPAREN	4
+#define A_RPAREN	5
+#define A_NOT		6	/* ! */
+#define A_BNOT		7	/* ~ */
+#define A_INCR		8	/* ++ */
+#define A_DECR		9	/* -- */
+#define A_QUEST		10
+#define A_COLON		11
+#define A_COMMA		12
+#define A_PARAM		13	/* $n, or $# if ar.val is -1 */
+#define A_ELEM		14	/* name[, with the subscript in ar.key */
+#define A_RBRACK	15
+/* binary operators, in the order of the precedence table */
+#define A_OR		16	/* || */
+#define A_AND		17	/* && */
+#define A_BOR		18
+#define A_BXOR		19
+#define A_BAND		20
+#define A_EQ		21
+#define A_NE		22
+#define A_LT		23
+#define A_GT		24
+#define A_LE		25
+#define A_GE		26
+#define A_LSHIFT	27
+#define A_RSHIFT	28
+#define A_ADD		29
+#define A_SUB		30
+#define A_MUL		31
+#define A_DIV		32
+#define A_REM		33
+#define A_POW		34	/* ** */
+
+static const char prec[] = {
+	1, 2, 3, 4, 5, 6, 6, 7, 7, 7, 7, 8, 8, 9, 9, 10, 10, 10, 11
+};
+
+#define isbinop(t)	((t) >= A_OR && (t) <= A_POW)
+#define precof(t)	prec[(t) - A_OR]
 
 /*
- * Recursive-descent parser replacing the original yacc/lex grammar.
- * Operator precedence (low to high):
- *   ||  &&  |  ^  &  == !=  < > <= >=  << >>  + -  * / %  unary
+ * Instructions.  The binary operators other than || and && are their
+ * tokens, as are ! and ~; the rest follow.  "n" is an operand.
  */
+#define OP_END		35	/* return the top of the stack */
+#define OP_PUSH		36	/* n: push consts[n] */
+#define OP_LOAD		37	/* n: push variable refs[n] */
+#define OP_STORE	38	/* n: set refs[n] to the top */
+#define OP_PREINC	39	/* n: ++refs[n], pushing the result */
+#define OP_PREDEC	40	/* n: --refs[n] */
+#define OP_POSTINC	41	/* n: refs[n]++ */
+#define OP_POSTDEC	42	/* n: refs[n]-- */
+#define OP_POP		43
+#define OP_NEG		44
+#define OP_BOOL		45	/* make the top 0 or 1 */
+#define OP_JMP		46	/* n: go to code[n] */
+#define OP_JZ		47	/* n: pop, and go to code[n] if it was 0 */
+#define OP_AND		48	/* n: if the top is 0, go to code[n], else pop */
+#define OP_OR		49	/* n: if not 0, make it 1 and go, else pop */
+#define OP_PARAM	50	/* n: push $n, or $# for -1 */
+/*
+ * Array elements.  The operand is an index in elems, and the subscript
+ * is on the stack.  OP_SUBSCR comes before the code of the subscript,
+ * which it skips for an associative array, whose key is its text.
+ */
+#define OP_SUBSCR	51	/* n: if an associative array, push 0 and skip */
+#define OP_ELOAD	52	/* n: replace the subscript by the element */
+#define OP_EPEEK	53	/* n: push the element, for op= */
+#define OP_ESTORE	54	/* n: pop the value and subscript, set, push */
+#define OP_EPREINC	55	/* n: ++element */
+#define OP_EPREDEC	56
+#define OP_EPOSTINC	57
+#define OP_EPOSTDEC	58
+
+/* the most the stack of a program may hold */
+#define ARITH_MAX_DEPTH	64
+
+/* an array element used in a program */
+struct arelem {
+	int ref;		/* the array, in refs */
+	int skip;		/* where the code after the subscript starts */
+	char *key;		/* the subscript, as a key */
+	int keylen;		/* its length, while compiling */
+	int keyvar;		/* the key is the value of variable key */
+};
+
+struct arprog {
+	char *text;		/* the expression */
+	arith_t *consts;	/* the constants */
+	struct numref *refs;	/* the variables used */
+	struct arelem *elems;	/* the array elements used */
+	int *code;		/* the instructions */
+};
+
+/* the state of the compiler */
+static struct {
+	char *p;		/* next character of the expression */
+	char *start;		/* the whole expression, for messages */
+	char *tokstart;		/* where the current token starts */
+	int tok;		/* the current token */
+	int op;			/* for A_ASSIGN, the operator or 0 */
+	arith_t val;		/* for A_NUM */
+	char *name;		/* for A_VAR and A_ELEM, the name */
+	int namelen;
+	char *key;		/* for A_ELEM, the subscript */
+	int keylen;
+	int braced;		/* A_ELEM was ${name[, so ] is followed by } */
+	int depth;		/* depth of the stack at this point */
+	int maxdepth;
+	int *code;		/* the code so far */
+	int ncode;
+	int codesize;
+	arith_t *consts;	/* the constants so far */
+	int nconsts;
+	int constsize;
+	char **names;		/* the variable names, pointing into p */
+	int *namelens;
+	int nnames;
+	int namesize;
+	struct arelem *elems;	/* the elements */
+	int nelems;
+	int elemsize;
+} ar;
 
-static long parse_or(void);
-static long parse_and(void);
-static long parse_bor(void);
-static long parse_bxor(void);
-static long parse_band(void);
-static long parse_eq(void);
-static long parse_cmp(void);
-static long parse_shift(void);
-static long parse_add(void);
-static long parse_mul(void);
-static long parse_unary(void);
-static long parse_primary(void);
+#define ARITH_CACHE	128	/* how many programs to keep */
 
+/*
+ * The cache of programs, with a list of the slots in use from the most
+ * to the least recently used.  The serial number of a slot changes
+ * whenever its program does.
+ */
+static struct arcache {
+	struct arprog *prog;	/* the program, or NULL */
+	unsigned hash;		/* hashkey of its text */
+	int serial;
+	struct arcache *prev;
+	struct arcache *next;
+} arcache[ARITH_CACHE];
+
+static struct arcache *arhead, *artail;
+static int narcache;		/* slots in use */
+static int arserial;
+static char *runtext;		/* the expression running, for messages */
+
+static int armatch(void *, const char *);
+
+static struct hashtab artab = { armatch };
+
+static void next(void);
+static void lexdollar(char *);
+static char *lexsub(char *);
+static void synerror(void);
+static void emit(int, int);
+static void pushconst(arith_t);
+static int isconst(int, int);
+static int varref(void);
+static int elemref(void);
+static char *elemkey(struct arprog *, struct arelem *);
+static void comma(void);
+static void assign(void);
+static void cond(void);
+static void binary(int);
+static void unary(void);
+static void primary(void);
+static struct arprog *compile(char *);
+static struct arcache *arlookup(char *);
+static void artouch(struct arcache *);
+static arith_t runprog(struct arprog *);
+static arith_t binop(int, arith_t, arith_t);
+
+
+/*
+ * Read the next token.
+ */
 static void
-skipws(void)
+next(void)
 {
-	while (*arith_buf == ' ' || *arith_buf == '\t' || *arith_buf == '\n')
-		arith_buf++;
+	char *p;
+	char *end;
+	int c;
+
+	p = ar.p;
+	while (*p == ' ' || *p == '\t' || *p == '\n')
+		p++;
+	ar.tokstart = p;
+	c = *p++;
+	if (is_digit(c)) {
+		ar.val = strtoll(p - 1, &end, 0);
+		if (is_in_name(*end))
+			synerror();
+		ar.p = end;
+		ar.tok = A_NUM;
+		return;
+	}
+	if (c == '$') {
+		lexdollar(p);
+		return;
+	}
+	if (is_name(c)) {
+		ar.name = p - 1;
+		while (is_in_name(*p))
+			p++;
+		ar.namelen = p - ar.name;
+		ar.tok = A_VAR;
+		if (*p == '[') {
+			p = lexsub(p);
+			ar.braced = 0;
+		}
+		ar.p = p;
+		return;
+	}
+#define OPEQ(t)	(*p == '=' ? (p++, ar.op = (t), A_ASSIGN) : (t))
+	switch (c) {
+	case '\0':
+		p--;
+		c = A_END;
+		break;
+	case '(':	c = A_LPAREN;	break;
+	case ')':	c = A_RPAREN;	break;
+	case ']':	c = A_RBRACK;	break;
+	case '~':	c = A_BNOT;	break;
+	case '?':	c = A_QUEST;	break;
+	case ':':	c = A_COLON;	break;
+	case ',':	c = A_COMMA;	break;
+	case '^':	c = OPEQ(A_BXOR); break;
+	case '/':	c = OPEQ(A_DIV); break;
+	case '%':	c = OPEQ(A_REM); break;
+	case '!':
+		c = *p == '=' ? (p++, A_NE) : A_NOT;
+		break;
+	case '=':
+		c = *p == '=' ? (p++, A_EQ) : (ar.op = 0, A_ASSIGN);
+		break;
+	case '+':
+		c = *p == '+' ? (p++, A_INCR) : OPEQ(A_ADD);
+		break;
+	case '-':
+		c = *p == '-' ? (p++, A_DECR) : OPEQ(A_SUB);
+		break;
+	case '*':
+		c = *p == '*' ? (p++, OPEQ(A_POW)) : OPEQ(A_MUL);
+		break;
+	case '&':
+		c = *p == '&' ? (p++, A_AND) : OPEQ(A_BAND);
+		break;
+	case '|':
+		c = *p == '|' ? (p++, A_OR) : OPEQ(A_BOR);
+		break;
+	case '<':
+		if (*p == '<')
+			c = (p++, OPEQ(A_LSHIFT));
+		else
+			c = *p == '=' ? (p++, A_LE) : A_LT;
+		break;
+	case '>':
+		if (*p == '>')
+			c = (p++, OPEQ(A_RSHIFT));
+		else
+			c = *p == '=' ? (p++, A_GE) : A_GT;
+		break;
+	default:
+		synerror();
+	}
+#undef OPEQ
+	ar.p = p;
+	ar.tok = c;
 }
 
-static long
-parse_primary(void)
+
+/*
+ * The expression of (( )) is not expanded, so $name, ${name} and
+ * ${name[subscript]} are taken as names here, and $n, ${n} and $# as
+ * the positional parameters.  p is just after the '$'.
+ */
+static void
+lexdollar(char *p)
 {
-	long val;
-
-	skipws();
-	if (*arith_buf == '(') {
-		arith_buf++;
-		val = parse_or();
-		skipws();
-		if (*arith_buf != ')')
-			error("arithmetic expression: missing ')': \"%s\"",
-			    arith_startbuf);
-		arith_buf++;
-		return val;
+	int braced;
+
+	if ((braced = *p == '{') != 0)
+		p++;
+	if (is_name(*p)) {
+		ar.name = p;
+		while (is_in_name(*p))
+			p++;
+		ar.namelen = p - ar.name;
+		ar.tok = A_VAR;
+		if (braced && *p == '[') {
+			p = lexsub(p);
+			if (ar.key[ar.keylen + 1] != '}')
+				synerror();
+			ar.braced = 1;
+			ar.p = p;
+			return;
+		}
+	} else if (is_digit(*p)) {
+		ar.val = *p++ - '0';
+		while (braced && is_digit(*p))
+			ar.val = ar.val * 10 + *p++ - '0';
+		ar.tok = A_PARAM;
+	} else if (*p == '#') {
+		p++;
+		ar.val = -1;
+		ar.tok = A_PARAM;
+	} else
+		synerror();
+	if (braced && *p++ != '}')
+		synerror();
+	ar.p = p;
+}
+
+/*
+ * A name followed by a subscript.  p is at the '[', and the token ends
+ * after it, so that the subscript is read as an expression; the text
+ * up to the matching ']' is kept as the key.
+ */
+static char *
+lexsub(char *p)
+{
+	char *q;
+	int depth;
+
+	depth = 0;
+	for (q = p ; *q ; q++) {
+		if (*q == '[')
+			depth++;
+		else if (*q == ']' && --depth == 0)
+			break;
 	}
-	if (isdigit((unsigned char)*arith_buf)) {
-		char *end;
-		val = strtol(arith_buf, &end, 0);
-		arith_buf = end;
-		return val;
+	if (*q == '\0')
+		synerror();
+	ar.key = p + 1;
+	ar.keylen = q - ar.key;
+	ar.tok = A_ELEM;
+	return p + 1;
+}
+
+static void
+synerror(void)
+{
+	error("arithmetic expression: syntax error: \"%s\"", ar.start);
+}
+
+/*
+ * Add an instruction and its operand, if it has one, and keep track
+ * of the depth of the stack.
+ */
+static void
+emit(int op, int arg)
+{
+	if (ar.ncode + 2 > ar.codesize) {
+		ar.codesize = ar.codesize ? ar.codesize * 2 : 64;
+		ar.code = ckrealloc(ar.code, ar.codesize * sizeof *ar.code);
 	}
-	/* bare variable name: look up in shell variables */
-	if (isalpha((unsigned char)*arith_buf) || *arith_buf == '_') {
-		char varname[256];
-		int  vlen = 0;
-		char *varval;
-		while ((isalnum((unsigned char)*arith_buf) || *arith_buf == '_')
-		       && vlen < (int)sizeof(varname) - 1)
-			varname[vlen++] = *arith_buf++;
-		varname[vlen] = '\0';
-		varval = lookupvar(varname);
-		if (varval == NULL || *varval == '\0')
-			return 0;
-		return strtol(varval, NULL, 0);
+	ar.code[ar.ncode++] = op;
+	switch (op) {
+	case OP_PUSH:
+	case OP_LOAD:
+	case OP_PARAM:
+	case OP_PREINC:
+	case OP_PREDEC:
+	case OP_POSTINC:
+	case OP_POSTDEC:
+	case OP_EPEEK:
+		if (++ar.depth > ar.maxdepth)
+			ar.maxdepth = ar.depth;
+		/* fall through */
+	case OP_STORE:
+	case OP_JMP:
+	case OP_SUBSCR:
+	case OP_ELOAD:
+	case OP_EPREINC:
+	case OP_EPREDEC:
+	case OP_EPOSTINC:
+	case OP_EPOSTDEC:
+		ar.code[ar.ncode++] = arg;
+		break;
+	case OP_ESTORE:
+	case OP_JZ:
+	case OP_AND:
+	case OP_OR:
+		ar.code[ar.ncode++] = arg;
+		/* fall through */
+	case OP_POP:
+		ar.depth--;
+		break;
+	default:
+		if (isbinop(op))
+			ar.depth--;
+		break;
 	}
-	error("arithmetic expression: syntax error: \"%s\"", arith_startbuf);
-	return 0;
+	if (ar.maxdepth > ARITH_MAX_DEPTH)
+		error("arithmetic expression: too complex: \"%s\"", ar.start);
+}
+
+static void
+pushconst(arith_t val)
+{
+	if (ar.nconsts == ar.constsize) {
+		ar.constsize = ar.constsize ? ar.constsize * 2 : 16;
+		ar.consts = ckrealloc(ar.consts,
+		    ar.constsize * sizeof *ar.consts);
+	}
+	ar.consts[ar.nconsts] = val;
+	emit(OP_PUSH, ar.nconsts++);
 }
 
-static long
-parse_unary(void)
+/*
+ * Whether the code from start to end just pushes a constant.  If so,
+ * the constant is the last one in consts, which lets the code be
+ * folded.
+ */
+static int
+isconst(int start, int end)
+{
+	return end - start == 2 && ar.code[start] == OP_PUSH;
+}
+
+/*
+ * The reference for the variable of the current A_VAR token.  Each
+ * name gets a single reference however often it is used.
+ */
+static int
+varref(void)
 {
-	skipws();
-	if (*arith_buf == '!') {
-		arith_buf++;
-		return !parse_unary();
+	int i;
+
+	for (i = 0 ; i < ar.nnames ; i++) {
+		if (ar.namelens[i] == ar.namelen
+		 && memcmp(ar.names[i], ar.name, ar.namelen) == 0)
+			return i;
 	}
-	if (*arith_buf == '~') {
-		arith_buf++;
-		return ~parse_unary();
+	if (ar.nnames == ar.namesize) {
+		ar.namesize = ar.namesize ? ar.namesize * 2 : 8;
+		ar.names = ckrealloc(ar.names, ar.namesize * sizeof *ar.names);
+		ar.namelens = ckrealloc(ar.namelens,
+		    ar.namesize * sizeof *ar.namelens);
 	}
-	if (*arith_buf == '-' && *(arith_buf+1) != '-') {
-		arith_buf++;
-		return -parse_unary();
+	ar.names[ar.nnames] = ar.name;
+	ar.namelens[ar.nnames] = ar.namelen;
+	return ar.nnames++;
+}
+
+/*
+ * Compile the subscript of the current A_ELEM token, returning the
+ * element for the instruction which uses it.
+ */
+static int
+elemref(void)
+{
+	char *p, *q;
+	int e;
+	int braced;
+
+	if (ar.nelems == ar.elemsize) {
+		ar.elemsize = ar.elemsize ? ar.elemsize * 2 : 8;
+		ar.elems = ckrealloc(ar.elems, ar.elemsize * sizeof *ar.elems);
 	}
-	if (*arith_buf == '+' && *(arith_buf+1) != '+') {
-		arith_buf++;
-		return parse_unary();
+	e = ar.nelems++;
+	ar.elems[e].ref = varref();
+	ar.elems[e].key = ar.key;
+	ar.elems[e].keylen = ar.keylen;
+	ar.elems[e].keyvar = 0;
+	/* (( )) is not expanded, so a key $name or ${name} is looked up */
+	p = ar.key;
+	if (*p++ == '$') {
+		if ((braced = *p == '{') != 0)
+			p++;
+		q = p;
+		if (is_name(*q))
+			while (is_in_name(*q))
+				q++;
+		if (q > p && q + braced == ar.key + ar.keylen
+		 && (! braced || *q == '}')) {
+			ar.elems[e].key = p;
+			ar.elems[e].keylen = q - p;
+			ar.elems[e].keyvar = 1;
+		}
 	}
-	return parse_primary();
+	braced = ar.braced;
+	emit(OP_SUBSCR, e);
+	next();
+	comma();
+	if (ar.tok != A_RBRACK)
+		synerror();
+	if (braced)
+		ar.p++;		/* the '}', checked by lexdollar */
+	ar.elems[e].skip = ar.ncode;
+	next();
+	return e;
 }
 
-static long
-parse_mul(void)
+static void
+comma(void)
 {
-	long left = parse_unary();
-	for (;;) {
-		skipws();
-		if (*arith_buf == '*') {
-			arith_buf++;
-			left *= parse_unary();
-		} else if (*arith_buf == '/') {
-			arith_buf++;
-			long r = parse_unary();
-			if (r == 0)
-				error("arithmetic expression: division by zero: \"%s\"",
-				    arith_startbuf);
-			left /= r;
-		} else if (*arith_buf == '%') {
-			arith_buf++;
-			long r = parse_unary();
-			if (r == 0)
-				error("arithmetic expression: division by zero: \"%s\"",
-				    arith_startbuf);
-			left %= r;
-		} else
-			break;
+	assign();
+	while (ar.tok == A_COMMA) {
+		next();
+		emit(OP_POP, 0);
+		assign();
 	}
-	return left;
 }
 
-static long
-parse_add(void)
+static void
+assign(void)
 {
-	long left = parse_mul();
-	for (;;) {
-		skipws();
-		if (*arith_buf == '+' && *(arith_buf+1) != '+') {
-			arith_buf++;
-			left += parse_mul();
-		} else if (*arith_buf == '-' && *(arith_buf+1) != '-') {
-			arith_buf++;
-			left -= parse_mul();
-		} else
-			break;
+	char *p;
+	int ref, e;
+	int op;
+	int ncode, nconsts, nnames, nelems, depth;
+
+	if (ar.tok == A_ELEM) {
+		p = ar.tokstart;
+		ncode = ar.ncode;
+		nconsts = ar.nconsts;
+		nnames = ar.nnames;
+		nelems = ar.nelems;
+		depth = ar.depth;
+		e = elemref();
+		if (ar.tok == A_ASSIGN) {
+			op = ar.op;
+			next();
+			if (op != 0)
+				emit(OP_EPEEK, e);
+			assign();
+			if (op != 0)
+				emit(op, 0);
+			emit(OP_ESTORE, e);
+			return;
+		}
+		/* not an assignment; throw away the subscript and back up */
+		ar.ncode = ncode;
+		ar.nconsts = nconsts;
+		ar.nnames = nnames;
+		ar.nelems = nelems;
+		ar.depth = depth;
+		ar.p = p;
+		next();
+	} else if (ar.tok == A_VAR) {
+		p = ar.p;
+		ref = varref();
+		next();
+		if (ar.tok == A_ASSIGN) {
+			op = ar.op;
+			next();
+			if (op != 0)
+				emit(OP_LOAD, ref);
+			assign();
+			if (op != 0)
+				emit(op, 0);
+			emit(OP_STORE, ref);
+			return;
+		}
+		/* not an assignment; back up over the name */
+		ar.p = p;
+		ar.tok = A_VAR;
+		ar.name = ar.names[ref];
+		ar.namelen = ar.namelens[ref];
 	}
-	return left;
+	cond();
 }
 
-static long
-parse_shift(void)
+static void
+cond(void)
 {
-	long left = parse_add();
-	for (;;) {
-		skipws();
-		if (arith_buf[0] == '<' && arith_buf[1] == '<') {
-			arith_buf += 2;
-			left <<= parse_add();
-		} else if (arith_buf[0] == '>' && arith_buf[1] == '>') {
-			arith_buf += 2;
-			left >>= parse_add();
-		} else
-			break;
+	int jz, jmp;
+
+	binary(1);
+	if (ar.tok != A_QUEST)
+		return;
+	next();
+	emit(OP_JZ, 0);
+	jz = ar.ncode - 1;
+	comma();
+	emit(OP_JMP, 0);
+	jmp = ar.ncode - 1;
+	if (ar.tok != A_COLON)
+		synerror();
+	next();
+	ar.depth--;		/* only one branch is taken */
+	ar.code[jz] = ar.ncode;
+	cond();
+	ar.code[jmp] = ar.ncode;
+}
+
+/*
+ * Binary operators of precedence minprec and up, by precedence
+ * climbing.  An operator whose operands are both constants is done
+ * here, unless it would fail.
+ */
+static void
+binary(int minprec)
+{
+	int start, right;
+	int op, p, j;
+	arith_t a, b;
+
+	start = ar.ncode;
+	unary();
+	while (isbinop(ar.tok) && (p = precof(ar.tok)) >= minprec) {
+		op = ar.tok;
+		next();
+		if (op == A_OR || op == A_AND) {
+			emit(op == A_OR ? OP_OR : OP_AND, 0);
+			j = ar.ncode - 1;
+			binary(p + 1);
+			emit(OP_BOOL, 0);
+			ar.code[j] = ar.ncode;
+			continue;
+		}
+		right = ar.ncode;
+		/* ** groups right to left */
+		binary(op == A_POW ? p : p + 1);
+		if (isconst(start, right) && isconst(right, ar.ncode)) {
+			a = ar.consts[ar.nconsts - 2];
+			b = ar.consts[ar.nconsts - 1];
+			if (! ((op == A_DIV || op == A_REM) && b == 0)
+			 && ! (op == A_POW && b < 0)) {
+				ar.ncode = start;
+				ar.nconsts -= 2;
+				ar.depth -= 2;
+				pushconst(binop(op, a, b));
+				continue;
+			}
+		}
+		emit(op, 0);
 	}
-	return left;
 }
 
-static long
-parse_cmp(void)
+static void
+unary(void)
 {
-	long left = parse_shift();
-	for (;;) {
-		skipws();
-		if (arith_buf[0] == '<' && arith_buf[1] == '=') {
-			arith_buf += 2; left = left <= parse_shift();
-		} else if (arith_buf[0] == '>' && arith_buf[1] == '=') {
-			arith_buf += 2; left = left >= parse_shift();
-		} else if (arith_buf[0] == '<' && arith_buf[1] != '<') {
-			arith_buf++; left = left < parse_shift();
-		} else if (arith_buf[0] == '>' && arith_buf[1] != '>') {
-			arith_buf++; left = left > parse_shift();
+	int start;
+	int op;
+	int e;
+
+	switch (op = ar.tok) {
+	case A_NOT:
+	case A_BNOT:
+	case A_SUB:
+		next();
+		start = ar.ncode;
+		unary();
+		if (isconst(start, ar.ncode)) {
+			arith_t *vp = &ar.consts[ar.nconsts - 1];
+			*vp = op == A_NOT ? ! *vp
+			    : op == A_BNOT ? ~*vp : -(uarith_t)*vp;
 		} else
-			break;
+			emit(op == A_SUB ? OP_NEG : op, 0);
+		return;
+	case A_ADD:
+		next();
+		unary();
+		return;
+	case A_INCR:
+	case A_DECR:
+		next();
+		if (ar.tok == A_ELEM) {
+			e = elemref();
+			emit(op == A_INCR ? OP_EPREINC : OP_EPREDEC, e);
+			return;
+		}
+		if (ar.tok != A_VAR)
+			synerror();
+		emit(op == A_INCR ? OP_PREINC : OP_PREDEC, varref());
+		next();
+		return;
 	}
-	return left;
+	primary();
 }
 
-static long
-parse_eq(void)
+static void
+primary(void)
 {
-	long left = parse_cmp();
-	for (;;) {
-		skipws();
-		if (arith_buf[0] == '=' && arith_buf[1] == '=') {
-			arith_buf += 2; left = left == parse_cmp();
-		} else if (arith_buf[0] == '!' && arith_buf[1] == '=') {
-			arith_buf += 2; left = left != parse_cmp();
+	int ref;
+	int e;
+
+	switch (ar.tok) {
+	case A_NUM:
+		pushconst(ar.val);
+		next();
+		return;
+	case A_LPAREN:
+		next();
+		comma();
+		if (ar.tok != A_RPAREN)
+			error("arithmetic expression: missing ')': \"%s\"",
+			    ar.start);
+		next();
+		return;
+	case A_PARAM:
+		emit(OP_PARAM, (int)ar.val);
+		next();
+		return;
+	case A_VAR:
+		ref = varref();
+		next();
+		if (ar.tok == A_INCR || ar.tok == A_DECR) {
+			emit(ar.tok == A_INCR ? OP_POSTINC : OP_POSTDEC, ref);
+			next();
 		} else
-			break;
+			emit(OP_LOAD, ref);
+		return;
+	case A_ELEM:
+		e = elemref();
+		if (ar.tok == A_INCR || ar.tok == A_DECR) {
+			emit(ar.tok == A_INCR ? OP_EPOSTINC : OP_EPOSTDEC, e);
+			next();
+		} else
+			emit(OP_ELOAD, e);
+		return;
 	}
-	return left;
+	synerror();
 }
 
-static long
-parse_band(void)
+/*
+ * The key of an element, which only matters if the array is an
+ * associative one.
+ */
+static char *
+elemkey(struct arprog *pp, struct arelem *ep)
 {
-	long left = parse_eq();
-	for (;;) {
-		skipws();
-		if (arith_buf[0] == '&' && arith_buf[1] != '&') {
-			arith_buf++;
-			left &= parse_eq();
-		} else
-			break;
+	char *p;
+
+	if (! ep->keyvar || ! isassocref(&pp->refs[ep->ref]))
+		return ep->key;
+	if ((p = lookupvarref(ep->key)) == NULL)
+		return "";
+	return p;
+}
+
+/*
+ * Compile an expression into a single block of memory holding the
+ * program, its constants, its variable references and their names,
+ * its array elements and their keys, and a copy of the text.
+ */
+static struct arprog *
+compile(char *s)
+{
+	struct arprog *pp;
+	char *q;
+	int len;
+	int i;
+
+	ar.p = ar.start = s;
+	ar.depth = ar.maxdepth = 0;
+	ar.ncode = ar.nconsts = ar.nnames = ar.nelems = 0;
+	next();
+	comma();
+	if (ar.tok != A_END)
+		synerror();
+	emit(OP_END, 0);
+	len = ALIGN(sizeof *pp) + ALIGN(ar.nconsts * sizeof (arith_t))
+	    + ALIGN(ar.nnames * sizeof (struct numref))
+	    + ALIGN(ar.nelems * sizeof (struct arelem))
+	    + ALIGN(ar.ncode * sizeof (int)) + strlen(s) + 1;
+	for (i = 0 ; i < ar.nnames ; i++)
+		len += ar.namelens[i] + 1;
+	for (i = 0 ; i < ar.nelems ; i++)
+		len += ar.elems[i].keylen + 1;
+	pp = ckmalloc(len);
+	pp->consts = (arith_t *)((char *)pp + ALIGN(sizeof *pp));
+	pp->refs = (struct numref *)((char *)pp->consts
+	    + ALIGN(ar.nconsts * sizeof (arith_t)));
+	pp->elems = (struct arelem *)((char *)pp->refs
+	    + ALIGN(ar.nnames * sizeof (struct numref)));
+	pp->code = (int *)((char *)pp->elems
+	    + ALIGN(ar.nelems * sizeof (struct arelem)));
+	pp->text = (char *)pp->code + ALIGN(ar.ncode * sizeof (int));
+	/* the arrays are NULL until something is put in them */
+	if (ar.nconsts)
+		memcpy(pp->consts, ar.consts, ar.nconsts * sizeof (arith_t));
+	if (ar.ncode)
+		memcpy(pp->code, ar.code, ar.ncode * sizeof (int));
+	strcpy(pp->text, s);
+	q = pp->text + strlen(s) + 1;
+	for (i = 0 ; i < ar.nnames ; i++) {
+		pp->refs[i].name = q;
+		pp->refs[i].vp = NULL;
+		memcpy(q, ar.names[i], ar.namelens[i]);
+		q += ar.namelens[i];
+		*q++ = '\0';
+	}
+	for (i = 0 ; i < ar.nelems ; i++) {
+		pp->elems[i] = ar.elems[i];
+		pp->elems[i].key = q;
+		memcpy(q, ar.elems[i].key, ar.elems[i].keylen);
+		q += ar.elems[i].keylen;
+		*q++ = '\0';
 	}
-	return left;
+	return pp;
 }
 
-static long
-parse_bxor(void)
+static int
+armatch(void *ent, const char *text)
 {
-	long left = parse_band();
-	for (;;) {
-		skipws();
-		if (*arith_buf == '^') {
-			arith_buf++;
-			left ^= parse_band();
-		} else
-			break;
+	return strcmp(((struct arcache *)ent)->prog->text, text) == 0;
+}
+
+/*
+ * Find the program for an expression in the cache, compiling it if it
+ * is not there, and make it the most recently used.
+ */
+static struct arcache *
+arlookup(char *s)
+{
+	struct arcache *cp;
+	struct arprog *pp;
+	struct hashent *hp;
+	unsigned hash;
+
+	hash = hashkey(s);
+	if ((hp = htlookup(&artab, s, hash)) != NULL) {
+		cp = hp->ent;
+		artouch(cp);
+		return cp;
 	}
-	return left;
+	pp = compile(s);
+	INTOFF;
+	if (narcache < ARITH_CACHE) {
+		cp = &arcache[narcache++];
+	} else {
+		cp = artail;
+		htdelete(&artab, htlookup(&artab, cp->prog->text, cp->hash));
+		ckfree(cp->prog);
+	}
+	cp->prog = pp;
+	cp->hash = hash;
+	cp->serial = ++arserial;
+	htadd(&artab, cp, hash);
+	artouch(cp);
+	INTON;
+	return cp;
 }
 
-static long
-parse_bor(void)
+/*
+ * Move a slot to the head of the list, or put a new one there.
+ */
+static void
+artouch(struct arcache *cp)
 {
-	long left = parse_bxor();
-	for (;;) {
-		skipws();
-		if (arith_buf[0] == '|' && arith_buf[1] != '|') {
-			arith_buf++;
-			left |= parse_bxor();
-		} else
-			break;
+	if (cp == arhead)
+		return;
+	INTOFF;
+	if (cp->prev) {
+		cp->prev->next = cp->next;
+		if (cp->next)
+			cp->next->prev = cp->prev;
+		else
+			artail = cp->prev;
 	}
-	return left;
+	cp->prev = NULL;
+	cp->next = arhead;
+	if (arhead)
+		arhead->prev = cp;
+	else
+		artail = cp;
+	arhead = cp;
+	INTON;
 }
 
-static long
-parse_and(void)
+static arith_t
+runprog(struct arprog *pp)
 {
-	long left = parse_bor();
+	arith_t stack[ARITH_MAX_DEPTH];
+	arith_t *sp;
+	int *ip;
+	int op;
+	struct arelem *ep;
+	struct numref *rp;
+	arith_t n, m;
+
+	sp = stack - 1;
+	ip = pp->code;
 	for (;;) {
-		skipws();
-		if (arith_buf[0] == '&' && arith_buf[1] == '&') {
-			arith_buf += 2;
-			long r = parse_bor();
-			left = left ? (r ? r : 0) : 0;
-		} else
+		switch (op = *ip++) {
+		case OP_END:
+			return *sp;
+		case OP_PUSH:
+			*++sp = pp->consts[*ip++];
+			break;
+		case OP_LOAD:
+			*++sp = getnum(&pp->refs[*ip++]);
+			break;
+		case OP_STORE:
+			setnum(&pp->refs[*ip++], *sp);
+			break;
+		case OP_PARAM:
+			if ((op = *ip++) < 0)
+				*++sp = shellparam.nparam;
+			else if (op == 0)
+				*++sp = strtoll(arg0, NULL, 0);
+			else if (op <= shellparam.nparam)
+				*++sp = strtoll(shellparam.p[op - 1], NULL, 0);
+			else
+				*++sp = 0;
+			break;
+		case OP_PREINC:
+		case OP_PREDEC:
+			*++sp = (uarith_t)getnum(&pp->refs[*ip])
+			    + (op == OP_PREINC ? 1 : -1);
+			setnum(&pp->refs[*ip++], *sp);
+			break;
+		case OP_POSTINC:
+		case OP_POSTDEC:
+			*++sp = getnum(&pp->refs[*ip]);
+			setnum(&pp->refs[*ip++],
+			    (uarith_t)*sp + (op == OP_POSTINC ? 1 : -1));
+			break;
+		case OP_SUBSCR:
+			ep = &pp->elems[*ip++];
+			if (isassocref(&pp->refs[ep->ref])) {
+				*++sp = 0;
+				ip = pp->code + ep->skip;
+			}
+			break;
+		case OP_ELOAD:
+			ep = &pp->elems[*ip++];
+			*sp = getelemnum(&pp->refs[ep->ref], *sp, elemkey(pp, ep));
+			break;
+		case OP_EPEEK:
+			ep = &pp->elems[*ip++];
+			sp[1] = getelemnum(&pp->refs[ep->ref], *sp, elemkey(pp, ep));
+			sp++;
+			break;
+		case OP_ESTORE:
+			ep = &pp->elems[*ip++];
+			setelemnum(&pp->refs[ep->ref], sp[-1], elemkey(pp, ep), *sp);
+			sp--;
+			*sp = sp[1];
+			break;
+		case OP_EPREINC:
+		case OP_EPREDEC:
+		case OP_EPOSTINC:
+		case OP_EPOSTDEC:
+			ep = &pp->elems[*ip++];
+			rp = &pp->refs[ep->ref];
+			n = getelemnum(rp, *sp, elemkey(pp, ep));
+			m = (uarith_t)n
+			    + (op == OP_EPREINC || op == OP_EPOSTINC ? 1 : -1);
+			setelemnum(rp, *sp, elemkey(pp, ep), m);
+			*sp = op == OP_EPREINC || op == OP_EPREDEC ? m : n;
+			break;
+		case OP_POP:
+			sp--;
+			break;
+		case OP_NEG:
+			*sp = -(uarith_t)*sp;
+			break;
+		case A_NOT:
+			*sp = ! *sp;
+			break;
+		case A_BNOT:
+			*sp = ~*sp;
+			break;
+		case OP_BOOL:
+			*sp = *sp != 0;
+			break;
+		case OP_JMP:
+			ip = pp->code + *ip;
+			break;
+		case OP_JZ:
+			if (*sp-- == 0)
+				ip = pp->code + *ip;
+			else
+				ip++;
+			break;
+		case OP_AND:
+			if (*sp == 0)
+				ip = pp->code + *ip;
+			else
+				sp--, ip++;
+			break;
+		case OP_OR:
+			if (*sp != 0) {
+				*sp = 1;
+				ip = pp->code + *ip;
+			} else
+				sp--, ip++;
 			break;
+		default:
+			sp--;
+			*sp = binop(op, sp[0], sp[1]);
+			break;
+		}
 	}
-	return left;
 }
 
-static long
-parse_or(void)
+static arith_t
+binop(int op, arith_t a, arith_t b)
 {
-	long left = parse_and();
-	for (;;) {
-		skipws();
-		if (arith_buf[0] == '|' && arith_buf[1] == '|') {
-			arith_buf += 2;
-			long r = parse_and();
-			left = left ? left : (r ? r : 0);
-		} else
-			break;
+	uarith_t r, u;
+
+	switch (op) {
+	case A_BOR:	return a | b;
+	case A_BXOR:	return a ^ b;
+	case A_BAND:	return a & b;
+	case A_EQ:	return a == b;
+	case A_NE:	return a != b;
+	case A_LT:	return a < b;
+	case A_GT:	return a > b;
+	case A_LE:	return a <= b;
+	case A_GE:	return a >= b;
+	case A_LSHIFT:	return (uarith_t)a << (b & 63);
+	case A_RSHIFT:	return a >> (b & 63);
+	case A_ADD:	return (uarith_t)a + (uarith_t)b;
+	case A_SUB:	return (uarith_t)a - (uarith_t)b;
+	case A_MUL:	return (uarith_t)a * (uarith_t)b;
+	case A_DIV:
+	case A_REM:
+		if (b == 0)
+			error("arithmetic expression: division by zero: \"%s\"",
+			    runtext);
+		if (b == -1)	/* the one quotient which can overflow */
+			return op == A_DIV ? -(uarith_t)a : 0;
+		return op == A_DIV ? a / b : a % b;
+	case A_POW:
+		if (b < 0)
+			error("arithmetic expression: negative exponent: \"%s\"",
+			    runtext);
+		r = 1;
+		for (u = a ; b != 0 ; b >>= 1) {
+			if (b & 1)
+				r *= u;
+			u *= u;
+		}
+		return r;
 	}
-	return left;
+	return 0;
 }
 
-int
+arith_t
 arith(s)
 	char *s;
 {
-	long result;
+	struct arcache *cp;
+	char *savetext;
+	arith_t result;
 
-	arith_buf = arith_startbuf = s;
+	cp = arlookup(s);
+	savetext = runtext;
+	runtext = cp->prog->text;
+	result = runprog(cp->prog);
+	runtext = savetext;
+	return result;
+}
 
-	INTOFF;
-	result = parse_or();
-	skipws();
-	if (*arith_buf != '\0')
-		error("arithmetic expression: syntax error: \"%s\"",
-		    arith_startbuf);
-	INTON;
+/*
+ * Evaluate the expression of a (( )) command.  The node keeps the slot
+ * and serial number of its program, which stay good until the program
+ * drops out of the cache.
+ */
+arith_t
+arithnode(n)
+	union node *n;
+{
+	struct arcache *cp;
+	char *savetext;
+	arith_t result;
+
+	cp = &arcache[n->narith.slot];
+	if (cp->prog == NULL || cp->serial != n->narith.serial) {
+		cp = arlookup(n->narith.text);
+		n->narith.slot = cp - arcache;
+		n->narith.serial = cp->serial;
+	} else
+		artouch(cp);
+	savetext = runtext;
+	runtext = cp->prog->text;
+	result = runprog(cp->prog);
+	runtext = savetext;
+	return result;
+}
+
+/*
+ * Convert n to decimal.  The digits are put at the end of buf, which
+ * must have room for ARITH_MAX_LEN characters, and the start of them
+ * is returned.
+ */
+
+char *
+fmtarith(n, buf)
+	arith_t n;
+	char *buf;
+{
+	uarith_t u;
+	char *p;
 
-	return (int)result;
+	u = n < 0 ? -(uarith_t)n : n;
+	p = buf + ARITH_MAX_LEN;
+	*--p = '\0';
+	do
+		*--p = '0' + u % 10;
+	while ((u /= 10) != 0);
+	if (n < 0)
+		*--p = '-';
+	return p;
 }
 
 void
@@ -352,7 +1188,8 @@ expcmd(argc, argv)
 	char *p;
 	char *concat;
 	char **ap;
-	long i;
+	arith_t i;
+	char buf[ARITH_MAX_LEN];
 
 	if (argc > 1) {
 		p = argv[1];
@@ -377,6 +1214,6 @@ expcmd(argc, argv)
 
 	i = arith(p);
 
-	out1fmt("%d\n", (int)i);
+	out1fmt("%s\n", fmtarith(i, buf));
 	return (! i);
 }
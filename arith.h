@@ -33,5 +33,13 @@
  *	@(#)arith.h	1.1 (Berkeley) 5/4/95
  */
 
-int arith __P((char *));
+/* room for any arith_t in decimal, with the sign and a null */
+#define ARITH_MAX_LEN	21
+/* the longest variable name arithmetic handles, with a null */
+#define ARITH_MAX_NAME	256
+
+arith_t arith __P((char *));
+union node;
+arith_t arithnode __P((union node *));
+char *fmtarith __P((arith_t, char *));
 int expcmd __P((int , char **));
@@ -348,3 +348,44 @@ getpwd() {
 	curdir = savestr(buf);
 	setvar("PWD", curdir, VEXPORT);
 }
+
+
+
+/*
+ * Remember the current and previous directories, so that restorecwd
+ * can go back to them when a command substitution which the shell
+ * runs itself has done a cd.
+ */
+
+void
+savecwd(save)
+	char **save;
+	{
+	getpwd();
+	INTOFF;
+	save[0] = savestr(curdir);
+	save[1] = prevdir ? savestr(prevdir) : NULL;
+	INTON;
+}
+
+
+void
+restorecwd(save)
+	char **save;
+	{
+	INTOFF;
+	if (curdir == NULL || ! equal(curdir, save[0])) {
+		hashcd();
+		if (chdir(save[0]) < 0) {
+			ckfree(save[0]);
+			save[0] = NULL;
+		}
+	}
+	if (curdir)
+		ckfree(curdir);
+	if (prevdir)
+		ckfree(prevdir);
+	curdir = save[0];
+	prevdir = save[1];
+	INTON;
+}
@@ -68,6 +68,7 @@ extern int exception;
 #define EXINT 0		/* SIGINT received */
 #define EXERROR 1	/* a generic error */
 #define EXSHELLPROC 2	/* execute a shell procedure */
+#define EXEXIT 3	/* exit from a command substitution run in the shell */
 
 
 /*
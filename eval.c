@@ -38,6 +38,8 @@
 static char sccsid[] = "@(#)eval.c	8.9 (Berkeley) 6/8/95";
 #endif /* not lint */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <regex.h>
 #include <stdlib.h>
@@ -87,6 +89,7 @@ MKINIT int evalskip;		/* set if we are skipping commands */
 STATIC int skipcount;		/* number of levels to skip */
 MKINIT int loopnest;		/* current loop nesting level */
 int funcnest;			/* depth of function calls */
+int backnest;			/* depth of substitutions run in the shell */
 
 
 struct strlist *cmdenviron;
@@ -94,18 +97,51 @@ int exitstatus;			/* exit status of last command */
 int oexitstatus;		/* saved exit status */
 
 
+/*
+ * A name=(word...) argument of declare, typeset or local.  Cmdargs
+ * passes name= to the command and keeps the words here, where the
+ * command finds them with arrayelems.
+ */
+
+struct arrayarg {
+	struct arrayarg *next;
+	char *text;		/* the argument, name= or name+= */
+	struct strlist *elems;	/* the expanded words */
+};
+
+STATIC struct arrayarg *arrayargs;	/* those of the current command */
+
+
 STATIC void evalloop __P((union node *));
 STATIC void evalfor __P((union node *));
+STATIC void evalparfor __P((union node *, struct strlist *));
+STATIC int partmpfile __P((void));
 STATIC void evalcase __P((union node *, int));
 STATIC void evalsubshell __P((union node *, int));
 STATIC void expredir __P((union node *));
 STATIC void evalpipe __P((union node *));
+STATIC int spawnpipecmd __P((struct job *, union node *, int, int, int));
+STATIC int expandsafe __P((union node *));
+STATIC void cmdargs __P((union node *, struct arglist *, struct arglist *));
+STATIC void arrayarg __P((union node *, struct arglist *, struct arrayarg **));
+STATIC void arrayassign __P((union node *));
+STATIC void xtrace __P((struct strlist *, struct strlist *));
+STATIC void evalbackfile __P((union node *, struct backcmd *));
+STATIC int backsafe __P((union node *, int));
+STATIC int backsafecmd __P((union node *, int));
+STATIC void evalbackshell __P((union node *, int, struct backcmd *));
 STATIC void evalcommand __P((union node *, int, struct backcmd *));
+STATIC int spawncommand __P((struct job *, union node *, int, int, int,
+    char **, struct strlist *, char *, int));
 STATIC void evaldbracket __P((union node *));
 STATIC void evaldbracketb __P((union node *));
 STATIC void evalnarith __P((union node *));
+STATIC void evalforarith __P((union node *));
 STATIC void prehash __P((union node *));
 
+void savecwd __P((char **));
+void restorecwd __P((char **));
+
 
 /*
  * Called to reset things after an exception.
@@ -155,19 +191,22 @@ evalcmd(argc, argv)
                         STPUTC('\0', concat);
                         p = grabstackstr(concat);
                 }
-                evalstring(p);
+                evalstring(p, 0);
         }
         return exitstatus;
 }
 
 
 /*
- * Execute a command or commands contained in a string.
+ * Execute a command or commands contained in a string.  If flags has
+ * EV_EXIT set, the shell exits after the last command, which may then
+ * be exec'ed without forking.
  */
 
 void
-evalstring(s)
+evalstring(s, flags)
 	char *s;
+	int flags;
 	{
 	union node *n;
 	struct stackmark smark;
@@ -175,7 +214,7 @@ evalstring(s)
 	setstackmark(&smark);
 	setinputstring(s, 1);
 	while ((n = parsecmd(0)) != NEOF) {
-		evaltree(n, 0);
+		evaltree(n, parseatend() ? flags : flags & ~EV_EXIT);
 		popstackmark(&smark);
 	}
 	popfile();
@@ -252,6 +291,9 @@ evaltree(n, flags)
 	case NFOR:
 		evalfor(n);
 		break;
+	case NFORARITH:
+		evalforarith(n);
+		break;
 	case NCASE:
 		evalcase(n, flags);
 		break;
@@ -284,7 +326,7 @@ evaltree(n, flags)
 		break;
 	}
 out:
-	if (pendingsigs)
+	if (pendingsigs && backnest == 0)
 		dotrap();
 	if ((flags & EV_EXIT) || (eflag && exitstatus && !(flags & EV_TESTED)))
 		exitshell(exitstatus);
@@ -347,6 +389,10 @@ evalfor(n)
 	}
 	*arglist.lastp = NULL;
 
+	if (n->nfor.par) {
+		evalparfor(n, arglist.list);
+		goto out;
+	}
 	exitstatus = 0;
 	loopnest++;
 	for (sp = arglist.list ; sp ; sp = sp->next) {
@@ -369,6 +415,145 @@ out:
 
 
 
+/*
+ * A for loop with -P runs the body for each word in a child process,
+ * with at most the given number of them running at once.  The standard
+ * output of each child goes to a temporary file, which is copied to our
+ * standard output once that child and the ones before it have finished,
+ * so the output comes out in the order of the words.  The exit status
+ * is the largest one of all the iterations.  Since each iteration is a
+ * subshell, break and continue only end the iteration they are in.
+ */
+
+struct parjob {
+	struct job *jp;
+	int fd;			/* temporary file holding the output */
+};
+
+STATIC void
+evalparfor(n, list)
+	union node *n;
+	struct strlist *list;
+{
+	struct arglist arglist;
+	struct parjob *pj;
+	struct strlist *sp;
+	struct jmploc jmploc;
+	struct jmploc *volatile savehandler;
+	volatile int nstarted;
+	volatile int nemitted;
+	int nrun;
+	int par;
+	int worst;
+	int status;
+	int i;
+	char buf[4096];
+
+	arglist.lastp = &arglist.list;
+	oexitstatus = exitstatus;
+	expandarg(n->nfor.par, &arglist, EXP_FULL | EXP_TILDE);
+	*arglist.lastp = NULL;
+	if (arglist.list == NULL || ! is_number(arglist.list->text)
+	 || (par = number(arglist.list->text)) <= 0)
+		error("Bad -P count");
+	i = 0;
+	for (sp = list ; sp ; sp = sp->next)
+		i++;
+	if (i == 0) {
+		exitstatus = 0;
+		return;
+	}
+	pj = stalloc(i * sizeof *pj);
+	flushall();
+	nstarted = nemitted = 0;
+	nrun = 0;
+	worst = 0;
+	savehandler = handler;
+	if (setjmp(jmploc.loc)) {
+		for (i = nemitted ; i < nstarted ; i++)
+			close(pj[i].fd);
+		handler = savehandler;
+		longjmp(handler->loc, 1);
+	}
+	handler = &jmploc;
+	sp = list;
+	while (sp != NULL || nemitted < nstarted) {
+		if (sp != NULL && nrun < par) {
+			pj[nstarted].fd = partmpfile();
+			pj[nstarted].jp = makejob(n, 1);
+			nstarted++;
+			nrun++;
+			if (forkshell(pj[nstarted - 1].jp, n->nfor.body, FORK_NOJOB) == 0) {
+				handler = savehandler;
+				close(1);
+				copyfd(pj[nstarted - 1].fd, 1);
+				close(pj[nstarted - 1].fd);
+				setvar(n->nfor.var, sp->text, 0);
+				evaltree(n->nfor.body, EV_EXIT);
+			}
+			sp = sp->next;
+			continue;
+		}
+		/* emit the output of the iterations that are done, in order */
+		while (nemitted < nstarted && pj[nemitted].jp->state == JOBDONE) {
+			INTOFF;
+			status = waitforjob(pj[nemitted].jp);
+			if (status > worst)
+				worst = status;
+			lseek(pj[nemitted].fd, (off_t)0, SEEK_SET);
+			while ((i = read(pj[nemitted].fd, buf, sizeof buf)) > 0)
+				if (xwrite(1, buf, i) < 0)
+					break;
+			close(pj[nemitted].fd);
+			nemitted++;
+			INTON;
+		}
+		if (nemitted == nstarted && sp == NULL)
+			break;
+		INTOFF;
+		if (waitchild() < 0) {
+			INTON;
+			error("wait failed");
+		}
+		INTON;
+		for (nrun = 0, i = nemitted ; i < nstarted ; i++)
+			if (pj[i].jp->state == 0)
+				nrun++;
+	}
+	handler = savehandler;
+	exitstatus = worst;
+}
+
+
+
+/*
+ * Create an unlinked temporary file for evalparfor.  The descriptor is
+ * moved out of the way of user redirections and closed on exec.
+ */
+
+STATIC int
+partmpfile() {
+	char *dir;
+	char *name;
+	int fd;
+	int i;
+
+	if ((dir = lookupvar("TMPDIR")) == NULL || *dir == '\0')
+		dir = "/tmp";
+	name = stalloc(strlen(dir) + 11);
+	fmtstr(name, strlen(dir) + 11, "%s/shXXXXXX", dir);
+	if ((fd = mkstemp(name)) < 0)
+		error("cannot create %s: %s", name, errmsg(errno, E_CREAT));
+	unlink(name);
+	i = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+	close(fd);
+	if (i < 0)
+		error("Out of file descriptors");
+	return i;
+}
+
+
+
 STATIC void
 evalcase(n, flags)
 	union node *n;
@@ -494,21 +679,27 @@ evalpipe(n)
 				close(prevfd);
 				error("Pipe call failed");
 			}
+			fcntl(pip[0], F_SETFD, FD_CLOEXEC);
+			fcntl(pip[1], F_SETFD, FD_CLOEXEC);
 		}
-		if (forkshell(jp, lp->n, n->npipe.backgnd) == 0) {
+		if (spawnpipecmd(jp, lp->n, n->npipe.backgnd, prevfd, pip[1]))
+			;
+		else if (forkshell(jp, lp->n, n->npipe.backgnd) == 0) {
 			INTON;
 			if (prevfd > 0) {
 				close(0);
 				copyfd(prevfd, 0);
 				close(prevfd);
-			}
+			} else if (prevfd == 0)
+				fcntl(0, F_SETFD, 0);
 			if (pip[1] >= 0) {
 				close(pip[0]);
 				if (pip[1] != 1) {
 					close(1);
 					copyfd(pip[1], 1);
 					close(pip[1]);
-				}
+				} else
+					fcntl(1, F_SETFD, 0);
 			}
 			evaltree(lp->n, EV_EXIT);
 		}
@@ -529,10 +720,333 @@ evalpipe(n)
 
 
 /*
- * Execute a command inside back quotes.  If it's a builtin command, we
- * want to save its output in a block obtained from malloc.  Otherwise
- * we fork off a subprocess and get the output of the command via a pipe.
- * Should be called with interrupts off.
+ * Try to start an element of a pipeline without forking the shell.  This
+ * is only done for a simple command that runs a program, and only if its
+ * words can be expanded here in the parent without side effects.  Infd
+ * and outfd are the pipe ends to connect it to, or -1.  Returns nonzero
+ * if the command was started.
+ */
+
+STATIC int
+spawnpipecmd(jp, n, mode, infd, outfd)
+	struct job *jp;
+	union node *n;
+	int mode;
+	int infd, outfd;
+{
+	struct stackmark smark;
+	struct arglist arglist;
+	struct arglist varlist;
+	struct cmdentry cmdentry;
+	struct strlist *sp;
+	char **argv;
+	int argc;
+	char *path;
+	int started;
+
+	if (n->type != NCMD || uflag || ! expandsafe(n))
+		return 0;
+	setstackmark(&smark);
+	oexitstatus = exitstatus;
+	cmdargs(n, &arglist, &varlist);
+	started = 0;
+	argc = 0;
+	for (sp = arglist.list ; sp ; sp = sp->next)
+		argc++;
+	if (argc == 0)
+		goto out;
+	argv = stalloc(sizeof (char *) * (argc + 1));
+	for (sp = arglist.list ; sp ; sp = sp->next)
+		*argv++ = sp->text;
+	*argv = NULL;
+	argv -= argc;
+	path = pathval();
+	for (sp = varlist.list ; sp ; sp = sp->next)
+		if (strncmp(sp->text, "PATH=", 5) == 0)
+			path = sp->text + 5;
+	if (strchr(path, '%') != NULL)
+		goto out;		/* could mean reading a function file */
+	find_command(argv[0], &cmdentry, 0, path);
+	if (cmdentry.cmdtype != CMDNORMAL)
+		goto out;
+	if (spawncommand(jp, n, mode, infd, outfd, argv, varlist.list, path,
+	    cmdentry.u.index)) {
+		started = 1;
+		if (xflag)
+			xtrace(varlist.list, arglist.list);
+	}
+out:
+	popstackmark(&smark);
+	return started;
+}
+
+
+
+/*
+ * Check that expanding the words of a simple command can neither change
+ * the state of the shell nor raise an error:  no command or process
+ * substitutions, no arithmetic, no ${var=word} or ${var?word}, and no
+ * redirections to a file descriptor given by an expansion.
+ */
+
+STATIC int
+expandsafe(n)
+	union node *n;
+{
+	union node *argp;
+	union node *redir;
+	char *p;
+
+	argp = n->ncmd.args;
+	redir = n->ncmd.redirect;
+	for (;;) {
+		if (argp == NULL) {
+			if (redir == NULL)
+				return 1;
+			switch (redir->type) {
+			case NFROM:
+			case NTO:
+			case NAPPEND:
+				argp = redir->nfile.fname;
+				break;
+			case NFROMFD:
+			case NTOFD:
+				if (redir->ndup.vname)
+					return 0;
+				break;
+			default:
+				return 0;
+			}
+			redir = redir->nfile.next;
+			if (argp == NULL)
+				continue;
+		}
+		if (argp->type == NARRAY || assignword(argp->narg.text) == 2)
+			return 0;
+		for (p = argp->narg.text ; *p ; p++) {
+			switch (*p) {
+			case CTLESC:
+				p++;
+				break;
+			case CTLVAR:
+				if (p[1] & VSARRAY)	/* arithmetic */
+					return 0;
+				switch (*++p & VSTYPE) {
+				case VSQUESTION:
+				case VSASSIGN:
+					return 0;
+				}
+				break;
+			case CTLBACKQ:
+			case CTLBACKQ|CTLQUOTE:
+			case CTLARI:
+			case CTLPROCIN:
+			case CTLPROCOUT:
+				return 0;
+			}
+		}
+		argp = argp->narg.next;
+	}
+}
+
+
+
+/*
+ * Expand the words of a simple command.  Leading assignments go to
+ * varlist and the rest to arglist; redirections are expanded in place.
+ * Assignments to arrays are made at once, and only allowed when there
+ * is no command.
+ */
+
+STATIC void
+cmdargs(cmd, arglist, varlist)
+	union node *cmd;
+	struct arglist *arglist;
+	struct arglist *varlist;
+{
+	union node *argp;
+	union node *ap;
+	struct arrayarg *aargs;
+	int varflag;
+	int kind;
+
+	aargs = NULL;
+	arglist->lastp = &arglist->list;
+	varlist->lastp = &varlist->list;
+	varflag = 1;
+	for (argp = cmd->ncmd.args ; argp ; argp = argp->narg.next) {
+		if (varflag) {
+			kind = argp->type == NARRAY ? 2
+			    : assignword(argp->narg.text);
+			if (kind == 1) {
+				expandarg(argp, varlist, EXP_VARTILDE);
+				continue;
+			}
+			if (kind == 2) {
+				if (varflag == 1) {
+					for (ap = argp ; ap ; ap = ap->narg.next)
+						if (ap->type != NARRAY
+						 && ! assignword(ap->narg.text))
+							error("Array assignment before a command");
+					varflag = 2;
+				}
+				arrayassign(argp);
+				continue;
+			}
+		}
+		if (argp->type == NARRAY)
+			arrayarg(argp, arglist, &aargs);
+		else
+			expandarg(argp, arglist, EXP_FULL | EXP_TILDE);
+		varflag = 0;
+	}
+	*arglist->lastp = NULL;
+	*varlist->lastp = NULL;
+	expredir(cmd->ncmd.redirect);
+	arrayargs = aargs;	/* set last, as expanding may run commands */
+}
+
+
+/*
+ * Add a name=(word...) argument to arglist as name=, and record the
+ * expanded words in *aap.
+ */
+
+STATIC void
+arrayarg(argp, arglist, aap)
+	union node *argp;
+	struct arglist *arglist;
+	struct arrayarg **aap;
+{
+	struct arrayarg *aa;
+	struct arglist list;
+	struct strlist *sp;
+	union node *ep;
+
+	list.lastp = &list.list;
+	for (ep = argp->narray.elems ; ep ; ep = ep->narg.next)
+		expandarg(ep, &list, EXP_FULL | EXP_TILDE);
+	*list.lastp = NULL;
+	sp = (struct strlist *)stalloc(sizeof *sp);
+	sp->text = stalloc(strlen(argp->narray.text) + 1);
+	scopy(argp->narray.text, sp->text);	/* declare modifies it */
+	*arglist->lastp = sp;
+	arglist->lastp = &sp->next;
+	aa = (struct arrayarg *)stalloc(sizeof *aa);
+	aa->text = sp->text;
+	aa->elems = list.list;
+	aa->next = *aap;
+	*aap = aa;
+}
+
+
+/*
+ * If arg is a name=(word...) argument of the current command, set
+ * *listp to the words and return 1; otherwise return 0.
+ */
+
+int
+arrayelems(arg, listp)
+	char *arg;
+	struct strlist **listp;
+{
+	struct arrayarg *aa;
+
+	for (aa = arrayargs ; aa ; aa = aa->next) {
+		if (aa->text == arg) {
+			*listp = aa->elems;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * Make an assignment to an array, given as a name=(word...) node, or
+ * to an element of one, given as a word name[subscript]=value.
+ */
+
+STATIC void
+arrayassign(argp)
+	union node *argp;
+{
+	struct arglist list;
+	struct strlist *sp;
+	union node *ep;
+	char *p;
+	char *name;
+	int len;
+
+	list.lastp = &list.list;
+	if (argp->type != NARRAY) {
+		expandarg(argp, &list, EXP_VARTILDE);
+		if (xflag)
+			xtrace(list.list, NULL);
+		setelemeq(list.list->text);
+		return;
+	}
+	for (ep = argp->narray.elems ; ep ; ep = ep->narg.next)
+		expandarg(ep, &list, EXP_FULL | EXP_TILDE);
+	*list.lastp = NULL;
+	p = argp->narray.text;
+	if (xflag) {
+		out2str("+ ");
+		out2str(p);
+		outc('(', &errout);
+		for (sp = list.list ; sp ; sp = sp->next) {
+			out2str(sp->text);
+			if (sp->next)
+				outc(' ', &errout);
+		}
+		out2str(")\n");
+		flushout(&errout);
+	}
+	len = strchr(p, '=') - p;
+	if (p[len - 1] == '+')
+		len--;
+	name = stalloc(len + 1);
+	memcpy(name, p, len);
+	name[len] = '\0';
+	setarray(name, list.list, p[len] == '+');
+}
+
+
+
+/*
+ * Print a command for the -x option.
+ */
+
+STATIC void
+xtrace(vars, args)
+	struct strlist *vars;
+	struct strlist *args;
+{
+	struct strlist *sp;
+
+	if (vars == NULL && args == NULL)
+		return;		/* nothing, or only arrays, which trace themselves */
+	outc('+', &errout);
+	for (sp = vars ; sp ; sp = sp->next) {
+		outc(' ', &errout);
+		out2str(sp->text);
+	}
+	for (sp = args ; sp ; sp = sp->next) {
+		outc(' ', &errout);
+		out2str(sp->text);
+	}
+	outc('\n', &errout);
+	flushout(&errout);
+}
+
+
+
+/*
+ * Execute a command inside back quotes.  If it only runs builtins and
+ * functions, or it's a builtin command, we want to save its output in
+ * a block obtained from malloc.  Otherwise we fork off a subprocess and
+ * get the output of the command via a pipe.  Should be called with
+ * interrupts off.
  */
 
 void
@@ -543,6 +1057,8 @@ evalbackcmd(n, result)
 	int pip[2];
 	struct job *jp;
 	struct stackmark smark;		/* unnecessary */
+	union node *redir;
+	int safe;
 
 	setstackmark(&smark);
 	result->fd = -1;
@@ -553,7 +1069,13 @@ evalbackcmd(n, result)
 		exitstatus = 0;
 		goto out;
 	}
-	if (n->type == NCMD) {
+	if (n->type == NCMD && n->ncmd.args == NULL
+	 && (redir = n->ncmd.redirect) != NULL && redir->type == NFROM
+	 && redir->nfile.fd == 0 && redir->nfile.next == NULL) {
+		evalbackfile(redir, result);
+	} else if ((safe = backsafe(n, 0)) >= 0) {
+		evalbackshell(n, safe, result);
+	} else if (n->type == NCMD) {
 		exitstatus = oexitstatus;
 		evalcommand(n, EV_BACKCMD, result);
 	} else {
@@ -583,6 +1105,331 @@ out:
 
 
 
+/*
+ * Handle $(< file) by reading the file into the result buffer.  A
+ * regular file is read with one read sized from fstat; anything else
+ * is read until end of file in growing chunks.  If the file cannot be
+ * opened or read, the substitution is empty and the status is 2, as
+ * for a failed redirection.
+ */
+
+STATIC void
+evalbackfile(redir, result)
+	union node *redir;
+	struct backcmd *result;
+{
+	struct arglist fn;
+	struct stat statb;
+	char *fname;
+	char *buf;
+	int size;
+	int len;
+	int fd;
+	int i;
+
+	fn.lastp = &fn.list;
+	oexitstatus = exitstatus;
+	expandarg(redir->nfile.fname, &fn, EXP_TILDE | EXP_REDIR);
+	fname = fn.list->text;
+	if ((fd = open(fname, O_RDONLY)) < 0) {
+		outfmt(&errout, "cannot open %s: %s\n", fname,
+		    errmsg(errno, E_OPEN));
+		flushout(&errout);
+		exitstatus = 2;
+		return;
+	}
+	buf = NULL;
+	if (fstat(fd, &statb) < 0)
+		goto readerr;
+	size = 512;
+	if (S_ISREG(statb.st_mode) && statb.st_size < 0x7fffffff)
+		size = statb.st_size + 1;	/* + 1 to see end of file */
+	buf = ckmalloc(size);
+	len = 0;
+	for (;;) {
+		if (len == size) {
+			size <<= 1;
+			buf = ckrealloc(buf, size);
+		}
+		while ((i = read(fd, buf + len, size - len)) < 0
+		    && errno == EINTR);
+		if (i < 0)
+			goto readerr;
+		if (i == 0)
+			break;
+		len += i;
+	}
+	close(fd);
+	result->buf = buf;
+	result->nleft = len;
+	exitstatus = 0;
+	return;
+
+readerr:
+	outfmt(&errout, "cannot read %s: %s\n", fname, errmsg(errno, E_OPEN));
+	flushout(&errout);
+	close(fd);
+	if (buf)
+		ckfree(buf);
+	exitstatus = 2;
+}
+
+
+/*
+ * Decide whether a command substitution can be run by the shell itself.
+ * It may only run builtins whose effects evalbackshell knows how to
+ * undo, and functions which in turn pass this test; anything that would
+ * fork, define a function or run a string as a command has to go to a
+ * subshell.  Returns -1 in that case, else the BQ_ flags below.  Depth
+ * is the number of function bodies we are inside.
+ */
+
+#define BQ_CD 01		/* the command may change directory */
+#define MAXBACKFUNC 8		/* function nesting we are willing to check */
+
+STATIC int
+backsafe(n, depth)
+	union node *n;
+	int depth;
+{
+	union node *cp;
+	int r1, r2;
+
+	if (n == NULL)
+		return 0;
+	switch (n->type) {
+	case NSEMI:
+	case NAND:
+	case NOR:
+	case NWHILE:
+	case NUNTIL:
+		if ((r1 = backsafe(n->nbinary.ch1, depth)) < 0
+		 || (r2 = backsafe(n->nbinary.ch2, depth)) < 0)
+			return -1;
+		return r1 | r2;
+	case NIF:
+		if ((r1 = backsafe(n->nif.test, depth)) < 0
+		 || (r2 = backsafe(n->nif.ifpart, depth)) < 0)
+			return -1;
+		r1 |= r2;
+		if ((r2 = backsafe(n->nif.elsepart, depth)) < 0)
+			return -1;
+		return r1 | r2;
+	case NFOR:
+		if (n->nfor.par)
+			return -1;
+		return backsafe(n->nfor.body, depth);
+	case NFORARITH:
+		return backsafe(n->nforarith.body, depth);
+	case NCASE:
+		r1 = 0;
+		for (cp = n->ncase.cases ; cp ; cp = cp->nclist.next) {
+			if ((r2 = backsafe(cp->nclist.body, depth)) < 0)
+				return -1;
+			r1 |= r2;
+		}
+		return r1;
+	case NNOT:
+		return backsafe(n->nnot.com, depth);
+	case NREDIR:
+		return backsafe(n->nredir.n, depth);
+	case NCMD:
+		if (n->ncmd.backgnd)
+			return -1;
+		return backsafecmd(n, depth);
+	case NDBRACKET:
+	case NDBRACKETB:
+	case NARITH:
+		return 0;
+	}
+	return -1;
+}
+
+
+/*
+ * The simple command case of backsafe.  The command name has to be a
+ * plain word so that we know now what it will run.
+ */
+
+STATIC int
+backsafecmd(n, depth)
+	union node *n;
+	int depth;
+{
+	union node *argp;
+	struct cmdentry entry;
+	char *p;
+
+	for (argp = n->ncmd.args ; argp ; argp = argp->narg.next) {
+		p = argp->narg.text;
+		if (! is_name(*p))
+			break;
+		do
+			p++;
+		while (is_in_name(*p));
+		if (*p != '=')
+			break;
+	}
+	if (argp == NULL)		/* assignments only */
+		return 0;
+	for (p = argp->narg.text ; *p ; p++) {
+		if ((unsigned char)*p >= (unsigned char)CTLESC
+		 || *p == '*' || *p == '?' || *p == '[' || *p == '~')
+			return -1;
+	}
+	find_command(argp->narg.text, &entry, 0, pathval());
+	if (entry.cmdtype == CMDFUNCTION) {
+		if (depth >= MAXBACKFUNC)
+			return -1;
+		return backsafe(entry.u.func, depth + 1);
+	}
+	if (entry.cmdtype != CMDBUILTIN)
+		return -1;
+	switch (entry.u.index) {
+	case CDCMD:
+		return BQ_CD;
+	case SHIFTCMD:		/* shifts the caller's parameters in place */
+		return depth > 0 ? 0 : -1;
+	case UNSETCMD:
+		while ((argp = argp->narg.next) != NULL) {
+			p = argp->narg.text;
+			if (*p == '-' && ! equal(p, "-v"))
+				return -1;
+		}
+		return 0;
+	case BREAKCMD:
+	case ECHOCMD:
+	case EXITCMD:
+	case EXPCMD:
+	case EXPORTCMD:
+	case TESTCMD:
+	case BRACKETCMD:
+	case FALSECMD:
+	case GETOPTSCMD:
+	case LOCALCMD:
+	case PRINTFCMD:
+	case PWDCMD:
+	case READCMD:
+	case RETURNCMD:
+	case SETCMD:
+	case SETVARCMD:
+	case TRUECMD:
+		return 0;
+	}
+	return -1;
+}
+
+
+/*
+ * Run a command substitution that backsafe has passed without forking.
+ * Its output goes to memout.  The variables, options, positional
+ * parameters and current directory of the shell are saved first and
+ * put back afterwards, so the command behaves as if it ran in a
+ * subshell.  Traps are held until we are done, and an exit (including
+ * one caused by the -e flag) only leaves the substitution.
+ */
+
+STATIC void
+evalbackshell(n, safe, result)
+	union node *n;
+	int safe;
+	struct backcmd *result;
+{
+	struct jmploc jmploc;
+	struct jmploc *savehandler;
+	struct output savememout;
+	struct output *saveout1, *saveout2;
+	struct redirtab *saveredir;
+	struct localvar *savemark, *savelocals;
+	struct shparam saveparam;
+	char saveopts[NOPTS];
+	char *savedir[2];
+	char *savecmdname;
+	int saveloopnest, savefuncnest;
+	int savesuppress;
+	int changed;
+	int e;
+	int i;
+
+	flushall();
+	savesuppress = suppressint;
+	INTOFF;
+	savememout = memout;
+	memout.buf = NULL;
+	memout.nextc = NULL;
+	memout.nleft = 0;
+	memout.bufsize = 64;
+	saveout1 = out1;
+	saveout2 = out2;
+	out1 = &memout;
+	saveredir = redirlist;
+	savehandler = handler;
+	savecmdname = commandname;
+	saveloopnest = loopnest;
+	savefuncnest = funcnest;
+	saveparam = shellparam;
+	shellparam.malloc = 0;
+	for (i = 0 ; i < NOPTS ; i++)
+		saveopts[i] = optlist[i].val;
+	if (safe & BQ_CD)
+		savecwd(savedir);
+	savelocals = localvars;
+	savemark = savevars();
+	backnest++;
+	e = -1;
+	if (setjmp(jmploc.loc)) {
+		e = exception;
+		if (e == EXINT)
+			exitstatus = SIGINT+128;
+		else if (e != EXEXIT)
+			exitstatus = 2;
+	} else {
+		handler = &jmploc;
+		exitstatus = oexitstatus;
+		INTON;
+		evaltree(n, 0);
+		INTOFF;
+	}
+	suppressint = savesuppress + 1;
+	handler = savehandler;
+	commandname = savecmdname;
+	backnest--;
+	while (redirlist != saveredir)
+		popredir();
+	out1 = saveout1;
+	out2 = saveout2;
+	evalskip = 0;
+	skipcount = 0;
+	loopnest = saveloopnest;
+	funcnest = savefuncnest;
+	if (safe & BQ_CD)
+		restorecwd(savedir);
+	restorevars(savemark, savelocals);
+	freeparam(&shellparam);
+	shellparam = saveparam;
+	changed = 0;
+	for (i = 0 ; i < NOPTS ; i++) {
+		if (optlist[i].val != saveopts[i]) {
+			optlist[i].val = saveopts[i];
+			changed = 1;
+		}
+	}
+	if (changed)
+		optschanged();
+	result->buf = memout.buf;
+	result->nleft = memout.nextc - memout.buf;
+	memout = savememout;
+	if (e == EXINT) {
+		if (result->buf)
+			ckfree(result->buf);
+		result->buf = NULL;
+		result->nleft = 0;
+		exraise(EXINT);
+	}
+	INTON;
+}
+
+
 /*
  * Execute a [[ compound test command.
  */
@@ -637,12 +1484,49 @@ STATIC void
 evalnarith(n)
 	union node *n;
 {
-	long val;
-	val = arith(n->narith.text);
+	arith_t val;
+	val = arithnode(n);
 	exitstatus = (val != 0) ? 0 : 1;
 }
 
 
+/*
+ * The arithmetic for loop.  The expressions are evaluated directly,
+ * not run as commands, so they do not change the exit status.
+ */
+
+STATIC void
+evalforarith(n)
+	union node *n;
+{
+	int status;
+
+	if (n->nforarith.init)
+		(void)arithnode(n->nforarith.init);
+	loopnest++;
+	status = 0;
+	for (;;) {
+		if (n->nforarith.cond && arithnode(n->nforarith.cond) == 0)
+			break;
+		evaltree(n->nforarith.body, 0);
+		status = exitstatus;
+		if (evalskip) {
+			if (evalskip == SKIPCONT && --skipcount <= 0)
+				evalskip = 0;
+			else {
+				if (evalskip == SKIPBREAK && --skipcount <= 0)
+					evalskip = 0;
+				break;
+			}
+		}
+		if (n->nforarith.step)
+			(void)arithnode(n->nforarith.step);
+	}
+	loopnest--;
+	exitstatus = status;
+}
+
+
 STATIC void
 evaldbracketb(n)
 	union node *n;
@@ -717,13 +1601,11 @@ evalcommand(cmd, flags, backcmd)
 	struct backcmd *backcmd;
 {
 	struct stackmark smark;
-	union node *argp;
 	struct arglist arglist;
 	struct arglist varlist;
 	char **argv;
 	int argc;
 	char **envp;
-	int varflag;
 	struct strlist *sp;
 	int mode;
 	int pip[2];
@@ -734,8 +1616,10 @@ evalcommand(cmd, flags, backcmd)
 	char *volatile savecmdname;
 	volatile struct shparam saveparam;
 	struct localvar *volatile savelocalvars;
+	struct output *saveout1, *saveout2;
 	volatile int e;
 	char *lastarg;
+	char *path;
 #if __GNUC__
 	/* Avoid longjmp clobbering */
 	(void) &argv;
@@ -747,28 +1631,9 @@ evalcommand(cmd, flags, backcmd)
 	/* First expand the arguments. */
 	TRACE(("evalcommand(0x%lx, %d) called\n", (long)cmd, flags));
 	setstackmark(&smark);
-	arglist.lastp = &arglist.list;
-	varlist.lastp = &varlist.list;
-	varflag = 1;
 	oexitstatus = exitstatus;
 	exitstatus = 0;
-	for (argp = cmd->ncmd.args ; argp ; argp = argp->narg.next) {
-		char *p = argp->narg.text;
-		if (varflag && is_name(*p)) {
-			do {
-				p++;
-			} while (is_in_name(*p));
-			if (*p == '=') {
-				expandarg(argp, &varlist, EXP_VARTILDE);
-				continue;
-			}
-		}
-		expandarg(argp, &arglist, EXP_FULL | EXP_TILDE);
-		varflag = 0;
-	}
-	*arglist.lastp = NULL;
-	*varlist.lastp = NULL;
-	expredir(cmd->ncmd.redirect);
+	cmdargs(cmd, &arglist, &varlist);
 	argc = 0;
 	for (sp = arglist.list ; sp ; sp = sp->next)
 		argc++;
@@ -785,27 +1650,16 @@ evalcommand(cmd, flags, backcmd)
 	argv -= argc;
 
 	/* Print the command if xflag is set. */
-	if (xflag) {
-		outc('+', &errout);
-		for (sp = varlist.list ; sp ; sp = sp->next) {
-			outc(' ', &errout);
-			out2str(sp->text);
-		}
-		for (sp = arglist.list ; sp ; sp = sp->next) {
-			outc(' ', &errout);
-			out2str(sp->text);
-		}
-		outc('\n', &errout);
-		flushout(&errout);
-	}
+	if (xflag)
+		xtrace(varlist.list, arglist.list);
 
 	/* Now locate the command. */
+	path = pathval();
 	if (argc == 0) {
 		cmdentry.cmdtype = CMDBUILTIN;
 		cmdentry.u.index = BLTINCMD;
 	} else {
 		static const char PATH[] = "PATH=";
-		char *path = pathval();
 
 		/*
 		 * Modify the command lookup path, if a PATH= assignment
@@ -839,7 +1693,7 @@ evalcommand(cmd, flags, backcmd)
 					strcat(s, " ");
 					strcat(s, argv[i]);
 				}
-				evalstring(s);
+				evalstring(s, 0);
 				return;
 			}
 			outfmt(out2, "%s: not found\n", argv[0]);
@@ -867,7 +1721,8 @@ evalcommand(cmd, flags, backcmd)
 
 	/* Fork off a child process if necessary. */
 	if (cmd->ncmd.backgnd
-	 || (cmdentry.cmdtype == CMDNORMAL && (flags & EV_EXIT) == 0)
+	 || (cmdentry.cmdtype == CMDNORMAL
+	    && ((flags & EV_EXIT) == 0 || havetraps()))
 	 || ((flags & EV_BACKCMD) != 0
 	    && (cmdentry.cmdtype != CMDBUILTIN
 		 || cmdentry.u.index == DOTCMD
@@ -878,7 +1733,14 @@ evalcommand(cmd, flags, backcmd)
 			mode = FORK_NOJOB;
 			if (pipe(pip) < 0)
 				error("Pipe call failed");
+			fcntl(pip[0], F_SETFD, FD_CLOEXEC);
+			fcntl(pip[1], F_SETFD, FD_CLOEXEC);
 		}
+		if (cmdentry.cmdtype == CMDNORMAL
+		 && spawncommand(jp, cmd, mode, -1,
+		    mode == FORK_NOJOB ? pip[1] : -1,
+		    argv, varlist.list, path, cmdentry.u.index))
+			goto parent;	/* at end of routine */
 		if (forkshell(jp, cmd, mode) != 0)
 			goto parent;	/* at end of routine */
 		if (flags & EV_BACKCMD) {
@@ -888,7 +1750,8 @@ evalcommand(cmd, flags, backcmd)
 				close(1);
 				copyfd(pip[1], 1);
 				close(pip[1]);
-			}
+			} else
+				fcntl(1, F_SETFD, 0);
 		}
 		flags |= EV_EXIT;
 	}
@@ -949,13 +1812,16 @@ evalcommand(cmd, flags, backcmd)
 			memout.bufsize = 64;
 			mode |= REDIR_BACKQ;
 		}
+		saveout1 = out1;
+		saveout2 = out2;
 		redirect(cmd->ncmd.redirect, mode);
 		savecmdname = commandname;
 		cmdenviron = varlist.list;
 		e = -1;
 		if (setjmp(jmploc.loc)) {
 			e = exception;
-			exitstatus = (e == EXINT)? SIGINT+128 : 2;
+			if (e != EXEXIT)
+				exitstatus = (e == EXINT)? SIGINT+128 : 2;
 			goto cmddone;
 		}
 		savehandler = handler;
@@ -966,8 +1832,8 @@ evalcommand(cmd, flags, backcmd)
 		exitstatus = (*builtinfunc[cmdentry.u.index])(argc, argv);
 		flushall();
 cmddone:
-		out1 = &output;
-		out2 = &errout;
+		out1 = saveout1;
+		out2 = saveout2;
 		freestdout();
 		if (e != EXSHELLPROC) {
 			commandname = savecmdname;
@@ -995,9 +1861,10 @@ cmddone:
 		trputs("normal command:  ");  trargs(argv);
 		clearredir();
 		redirect(cmd->ncmd.redirect, 0);
+		/* before the assignments, which would dirty the cached list */
+		envp = listenvironment(varlist.list);
 		for (sp = varlist.list ; sp ; sp = sp->next)
 			setvareq(sp->text, VEXPORT|VSTACK);
-		envp = environment();
 		shellexec(argv, envp, pathval(), cmdentry.u.index);
 		/*NOTREACHED*/
 	}
@@ -1023,6 +1890,49 @@ out:
 
 
 
+/*
+ * Start an external command without forking the shell, if that can be
+ * done.  The arguments and the assignments in varlist have already been
+ * expanded; path and index are what find_command used to locate the
+ * program.  Infd and outfd, unless -1, become the standard input and
+ * output of the command.  Returns nonzero if the command was started, zero if the
+ * caller has to fork instead.
+ */
+
+STATIC int
+spawncommand(jp, cmd, mode, infd, outfd, argv, varlist, path, index)
+	struct job *jp;
+	union node *cmd;
+	int mode;
+	int infd, outfd;
+	char **argv;
+	struct strlist *varlist;
+	char *path;
+	int index;
+{
+	char *file;
+	char **envp;
+
+	if (strchr(argv[0], '/') != NULL) {
+		file = argv[0];
+	} else {
+		while ((file = padvance(&path, argv[0])) != NULL) {
+			if (--index < 0 && pathopt == NULL)
+				break;
+			stunalloc(file);
+		}
+		if (file == NULL)
+			return 0;
+	}
+	if ((envp = listenvironment(varlist)) == NULL)
+		return 0;
+	trputs("spawned command:  ");  trargs(argv);
+	return spawnshell(jp, cmd, mode, infd, outfd, cmd->ncmd.redirect,
+	    file, argv, envp) > 0;
+}
+
+
+
 /*
  * Search for a command.  This is called before we fork so that the
  * location of the command will be available in the parent as well as
@@ -1146,13 +2056,15 @@ execcmd(argc, argv)
 {
 	if (argc > 1) {
 		struct strlist *sp;
+		char **envp;
 
 		iflag = 0;		/* exit on error */
 		mflag = 0;
 		optschanged();
+		envp = listenvironment(cmdenviron);
 		for (sp = cmdenviron; sp ; sp = sp->next)
 			setvareq(sp->text, VEXPORT|VSTACK);
-		shellexec(argv + 1, environment(), pathval(), 0);
+		shellexec(argv + 1, envp, pathval(), 0);
 
 	}
 	return 0;
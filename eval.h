@@ -49,10 +49,12 @@ struct backcmd {		/* result of evalbackcmd */
 };
 
 int evalcmd __P((int, char **));
-void evalstring __P((char *));
+void evalstring __P((char *, int));
 union node;	/* BLETCH for ansi C */
 void evaltree __P((union node *, int));
 void evalbackcmd __P((union node *, struct backcmd *));
+struct strlist;
+int arrayelems __P((char *, struct strlist **));
 
 #define EV_EXIT   01		/* exit after evaluating tree */
 #define EV_TESTED 02		/* exit status is checked; ignore -e flag */
@@ -66,3 +68,4 @@ int execcmd __P((int, char **));
 /* in_function returns nonzero if we are currently evaluating a function */
 #define in_function()	funcnest
 extern int funcnest;
+extern int backnest;
@@ -40,6 +40,7 @@ static char sccsid[] = "@(#)exec.c	8.4 (Berkeley) 6/8/95";
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -73,15 +74,14 @@ static char sccsid[] = "@(#)exec.c	8.4 (Berkeley) 6/8/95";
 #include "mystring.h"
 #include "show.h"
 #include "jobs.h"
+#include "hashtab.h"
 
 
-#define CMDTABLESIZE 31		/* should be prime */
 #define ARB 1			/* actual size determined at run time */
 
 
 
 struct tblentry {
-	struct tblentry *next;	/* next entry in hash chain */
 	union param param;	/* definition of builtin function */
 	short cmdtype;		/* index identifying command */
 	char rehash;		/* if set, cd done since entry created */
@@ -89,8 +89,41 @@ struct tblentry {
 };
 
 
-STATIC struct tblentry *cmdtable[CMDTABLESIZE];
+STATIC int cmdmatch __P((void *, const char *));
+
+STATIC struct hashtab cmdtable = { cmdmatch };
 STATIC int builtinloc = -1;		/* index in path of %builtin, or -1 */
+STATIC int relpathloc = -1;		/* index of first relative dir, or -1 */
+
+
+/*
+ * With the hashdirs option we keep a listing of every absolute directory
+ * in PATH (see pathindex).  A name missing from a directory's listing
+ * is not looked for there, and a name missing from all of them gets a
+ * CMDUNKNOWN entry in cmdtable whose param.index is the indexgen it was
+ * made under.  Listings are checked against the directory's modification
+ * time only when filegen has changed since the last check, so that
+ * lookups cost no system calls while the shell runs only builtins.
+ */
+
+struct pathdir {
+	char *name;		/* directory, as it appears in PATH */
+	int indexed;		/* absolute, so names is usable */
+	dev_t dev;		/* identity of the directory listed */
+	ino_t ino;
+	struct timespec mtime;
+	int hashsize;		/* size of hash, a power of two */
+	int *hash;		/* offsets into names plus one, 0 = empty */
+	char *names;		/* the names, each nul terminated */
+};
+
+STATIC struct pathdir *pathdirs;	/* one for each element of PATH */
+STATIC int npathdirs;
+STATIC char *pathdirpath;		/* the PATH pathdirs describes */
+STATIC int pathdirsok;		/* every element is indexed */
+STATIC int indexgen;		/* bumped when a listing changes */
+STATIC int checkgen = -1;		/* filegen at the last check */
+int filegen;			/* bumped when we may have made a file */
 
 
 STATIC void tryexec __P((char *, char **, char **));
@@ -99,6 +132,9 @@ STATIC void printentry __P((struct tblentry *, int));
 STATIC void clearcmdentry __P((int));
 STATIC struct tblentry *cmdlookup __P((char *, int));
 STATIC void delete_cmd_entry __P((void));
+STATIC struct pathdir *pathindex __P((char *));
+STATIC void readpathdir __P((struct pathdir *));
+STATIC int pathdirhas __P((struct pathdir *, char *));
 
 
 
@@ -309,7 +345,7 @@ hashcmd(argc, argv)
 	int argc;
 	char **argv; 
 {
-	struct tblentry **pp;
+	struct hashent *hp;
 	struct tblentry *cmdp;
 	int c;
 	int verbose;
@@ -320,21 +356,22 @@ hashcmd(argc, argv)
 	while ((c = nextopt("rv")) != '\0') {
 		if (c == 'r') {
 			clearcmdentry(0);
+			checkgen = -1;
 		} else if (c == 'v') {
 			verbose++;
 		}
 	}
 	if (*argptr == NULL) {
-		for (pp = cmdtable ; pp < &cmdtable[CMDTABLESIZE] ; pp++) {
-			for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
+		HTFOREACH(hp, &cmdtable) {
+			cmdp = hp->ent;
+			if (cmdp->cmdtype != CMDUNKNOWN)
 				printentry(cmdp, verbose);
-			}
 		}
 		return 0;
 	}
 	while ((name = *argptr) != NULL) {
 		if ((cmdp = cmdlookup(name, 0)) != NULL
-		 && (cmdp->cmdtype == CMDNORMAL
+		 && (cmdp->cmdtype == CMDNORMAL || cmdp->cmdtype == CMDUNKNOWN
 		     || (cmdp->cmdtype == CMDBUILTIN && builtinloc >= 0)))
 			delete_cmd_entry();
 		find_command(name, &entry, 1, pathval());
@@ -405,6 +442,7 @@ find_command(name, entry, printerr, path)
 	char *path;
 {
 	struct tblentry *cmdp;
+	struct pathdir *pd;
 	int index;
 	int prev;
 	char *fullname;
@@ -420,8 +458,15 @@ find_command(name, entry, printerr, path)
 	}
 
 	/* If name is in the table, and not invalidated by cd, we're done */
-	if ((cmdp = cmdlookup(name, 0)) != NULL && cmdp->rehash == 0)
-		goto success;
+	pd = pathindex(path);
+	if ((cmdp = cmdlookup(name, 0)) != NULL && cmdp->rehash == 0) {
+		if (cmdp->cmdtype != CMDUNKNOWN)
+			goto success;
+		if (pd && pathdirsok && cmdp->param.index == indexgen) {
+			e = ENOENT;
+			goto notfound;
+		}
+	}
 
 	/* If %builtin not in path, check for builtin next */
 	if (builtinloc < 0 && (i = find_builtin(name)) >= 0) {
@@ -435,7 +480,7 @@ find_command(name, entry, printerr, path)
 
 	/* We have to search path. */
 	prev = -1;		/* where to start */
-	if (cmdp) {		/* doing a rehash */
+	if (cmdp && cmdp->cmdtype != CMDUNKNOWN) {	/* doing a rehash */
 		if (cmdp->cmdtype == CMDBUILTIN)
 			prev = builtinloc;
 		else
@@ -471,6 +516,8 @@ loop:
 			TRACE(("searchexec \"%s\": no change\n", name));
 			goto success;
 		}
+		if (pd && pd[index].indexed && ! pathdirhas(&pd[index], name))
+			goto loop;
 		while (stat(fullname, &statb) < 0) {
 #ifdef SYSV
 			if (errno == EINTR)
@@ -512,9 +559,20 @@ loop:
 		goto success;
 	}
 
-	/* We failed.  If there was an entry for this command, delete it */
-	if (cmdp)
+	/*
+	 * We failed.  If there was an entry for this command, delete it,
+	 * unless the listings show that the command is nowhere in PATH.
+	 */
+	if (pd && pathdirsok && e == ENOENT) {
+		INTOFF;
+		cmdp = cmdlookup(name, 1);
+		cmdp->cmdtype = CMDUNKNOWN;
+		cmdp->param.index = indexgen;
+		cmdp->rehash = 0;
+		INTON;
+	} else if (cmdp && (cmdp = cmdlookup(name, 0)) != NULL)
 		delete_cmd_entry();
+notfound:
 	if (printerr)
 		outfmt(out2, "%s: %s\n", name, errmsg(e, E_EXEC));
 	entry->cmdtype = CMDUNKNOWN;
@@ -529,40 +587,50 @@ success:
 
 
 /*
- * Search the table of builtin commands.
+ * Search the table of builtin commands.  The table is indexed by a
+ * perfect hash generated by mkbuiltins, so one comparison is enough.
  */
 
 int
 find_builtin(name)
 	char *name;
 {
-	register const struct builtincmd *bp;
+	const struct builtincmd *bp;
+	int len;
+	int i;
 
-	for (bp = builtincmd ; bp->name ; bp++) {
-		if (*bp->name == *name && equal(bp->name, name))
-			return bp->code;
-	}
-	return -1;
+	if ((len = strlen(name)) == 0
+	 || (i = builtinhash[BUILTINHASH(name, len)]) < 0)
+		return -1;
+	bp = &builtincmd[i];
+	if (! equal(bp->name, name))
+		return -1;
+	return bp->code;
 }
 
 
 
 /*
- * Called when a cd is done.  Marks all commands so the next time they
- * are executed they will be rehashed.
+ * Called when a cd is done.  Marks the commands whose lookup went through
+ * a relative directory in PATH so the next time they are executed they
+ * will be rehashed.  Commands found before the first relative directory
+ * cannot be affected by the cd.
  */
 
 void
 hashcd() {
-	struct tblentry **pp;
+	struct hashent *hp;
 	struct tblentry *cmdp;
 
-	for (pp = cmdtable ; pp < &cmdtable[CMDTABLESIZE] ; pp++) {
-		for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
-			if (cmdp->cmdtype == CMDNORMAL
-			 || (cmdp->cmdtype == CMDBUILTIN && builtinloc >= 0))
-				cmdp->rehash = 1;
-		}
+	if (relpathloc < 0)
+		return;
+	HTFOREACH(hp, &cmdtable) {
+		cmdp = hp->ent;
+		if ((cmdp->cmdtype == CMDNORMAL
+		     && cmdp->param.index >= relpathloc)
+		 || (cmdp->cmdtype == CMDBUILTIN
+		     && builtinloc > relpathloc))
+			cmdp->rehash = 1;
 	}
 }
 
@@ -582,13 +650,17 @@ changepath(newval)
 	int index;
 	int firstchange;
 	int bltin;
+	int rel;
 
 	old = pathval();
 	new = newval;
 	firstchange = 9999;	/* assume no change */
 	index = 0;
 	bltin = -1;
+	rel = -1;
 	for (;;) {
+		if (rel < 0 && (new == newval || new[-1] == ':') && *new != '/')
+			rel = index;
 		if (*old != *new) {
 			firstchange = index;
 			if ((*old == '\0' && *new == ':')
@@ -611,6 +683,7 @@ changepath(newval)
 		firstchange = 0;
 	clearcmdentry(firstchange);
 	builtinloc = bltin;
+	relpathloc = rel;
 }
 
 
@@ -623,29 +696,202 @@ STATIC void
 clearcmdentry(firstchange)
 	int firstchange;
 {
-	struct tblentry **tblp;
-	struct tblentry **pp;
+	struct hashent *hp;
 	struct tblentry *cmdp;
 
 	INTOFF;
-	for (tblp = cmdtable ; tblp < &cmdtable[CMDTABLESIZE] ; tblp++) {
-		pp = tblp;
-		while ((cmdp = *pp) != NULL) {
-			if ((cmdp->cmdtype == CMDNORMAL &&
-			     cmdp->param.index >= firstchange)
-			 || (cmdp->cmdtype == CMDBUILTIN &&
-			     builtinloc >= firstchange)) {
-				*pp = cmdp->next;
-				ckfree(cmdp);
-			} else {
-				pp = &cmdp->next;
+	HTFOREACH(hp, &cmdtable) {
+		cmdp = hp->ent;
+		if ((cmdp->cmdtype == CMDNORMAL &&
+		     cmdp->param.index >= firstchange)
+		 || (cmdp->cmdtype == CMDBUILTIN &&
+		     builtinloc >= firstchange)
+		 || cmdp->cmdtype == CMDUNKNOWN) {
+			htdelete(&cmdtable, hp);
+			ckfree(cmdp);
+		}
+	}
+	INTON;
+}
+
+
+/*
+ * Return the listings for the directories in path, bringing them up to
+ * date first, or NULL if we are not keeping listings for this path.
+ * Elements with a %builtin or %func suffix are never indexed.
+ */
+
+STATIC struct pathdir *
+pathindex(path)
+	char *path;
+	{
+	struct pathdir *pd, *old;
+	struct stat statb;
+	char *p, *q;
+	int i, j, nold;
+
+	if (! Hflag || path != pathval())
+		return NULL;
+	if (pathdirpath == NULL || ! equal(pathdirpath, path)) {
+		INTOFF;
+		old = pathdirs;
+		nold = npathdirs;
+		if (pathdirpath)
+			ckfree(pathdirpath);
+		pathdirpath = savestr(path);
+		npathdirs = 1;
+		for (p = path ; *p ; p++)
+			if (*p == ':')
+				npathdirs++;
+		pathdirs = ckmalloc(npathdirs * sizeof *pathdirs);
+		pathdirsok = 1;
+		p = path;
+		for (i = 0 ; i < npathdirs ; i++) {
+			pd = &pathdirs[i];
+			for (q = p ; *q && *q != ':' ; q++);
+			pd->name = ckmalloc(q - p + 1);
+			memcpy(pd->name, p, q - p);
+			pd->name[q - p] = '\0';
+			pd->indexed = *p == '/' && strchr(pd->name, '%') == NULL;
+			if (! pd->indexed)
+				pathdirsok = 0;
+			pd->hashsize = 0;
+			pd->hash = NULL;
+			pd->names = NULL;
+			/* keep the listing of a directory that was already there */
+			for (j = 0 ; pd->indexed && j < nold ; j++) {
+				if (old[j].hash && equal(old[j].name, pd->name)) {
+					pd->dev = old[j].dev;
+					pd->ino = old[j].ino;
+					pd->mtime = old[j].mtime;
+					pd->hashsize = old[j].hashsize;
+					pd->hash = old[j].hash;
+					pd->names = old[j].names;
+					old[j].hash = NULL;
+					break;
+				}
+			}
+			p = q + 1;
+		}
+		for (j = 0 ; j < nold ; j++) {
+			ckfree(old[j].name);
+			if (old[j].hash) {
+				ckfree(old[j].hash);
+				ckfree(old[j].names);
 			}
 		}
+		if (old)
+			ckfree(old);
+		checkgen = -1;
+		indexgen++;
+		INTON;
+	}
+	if (checkgen != filegen) {
+		for (i = 0 ; i < npathdirs ; i++) {
+			pd = &pathdirs[i];
+			if (! pd->indexed)
+				continue;
+			if (stat(pd->name, &statb) < 0) {
+				statb.st_dev = 0;
+				statb.st_ino = 0;
+				statb.st_mtim.tv_sec = 0;
+				statb.st_mtim.tv_nsec = 0;
+			}
+			if (pd->hash == NULL
+			 || statb.st_dev != pd->dev || statb.st_ino != pd->ino
+			 || statb.st_mtim.tv_sec != pd->mtime.tv_sec
+			 || statb.st_mtim.tv_nsec != pd->mtime.tv_nsec) {
+				pd->dev = statb.st_dev;
+				pd->ino = statb.st_ino;
+				pd->mtime = statb.st_mtim;
+				readpathdir(pd);
+				indexgen++;
+			}
+		}
+		checkgen = filegen;
+	}
+	return pathdirs;
+}
+
+
+/*
+ * Read the names in a directory into its hash table.  A directory we
+ * cannot read gets an empty table.
+ */
+
+STATIC void
+readpathdir(pd)
+	struct pathdir *pd;
+	{
+	DIR *dirp;
+	struct dirent *dp;
+	char *names;
+	int len, size;
+	int n;
+	int i, off;
+	unsigned int h;
+
+	INTOFF;
+	if (pd->hash) {
+		ckfree(pd->hash);
+		ckfree(pd->names);
+	}
+	size = 1024;
+	names = ckmalloc(size);
+	len = 0;
+	n = 0;
+	if ((dirp = opendir(pd->name)) != NULL) {
+		while ((dp = readdir(dirp)) != NULL) {
+			if (dp->d_name[0] == '.' && (dp->d_name[1] == '\0'
+			    || (dp->d_name[1] == '.' && dp->d_name[2] == '\0')))
+				continue;
+			i = strlen(dp->d_name) + 1;
+			while (len + i > size) {
+				size <<= 1;
+				names = ckrealloc(names, size);
+			}
+			memcpy(names + len, dp->d_name, i);
+			len += i;
+			n++;
+		}
+		closedir(dirp);
+	}
+	for (pd->hashsize = 16 ; pd->hashsize < 2 * n ; pd->hashsize <<= 1);
+	pd->hash = ckmalloc(pd->hashsize * sizeof (int));
+	for (i = 0 ; i < pd->hashsize ; i++)
+		pd->hash[i] = 0;
+	for (off = 0 ; off < len ; off += strlen(names + off) + 1) {
+		h = hashstr(names + off) & (pd->hashsize - 1);
+		while (pd->hash[h] != 0)
+			h = (h + 1) & (pd->hashsize - 1);
+		pd->hash[h] = off + 1;
 	}
+	pd->names = names;
 	INTON;
+	TRACE(("readpathdir(\"%s\"): %d names\n", pd->name, n));
 }
 
 
+STATIC int
+pathdirhas(pd, name)
+	struct pathdir *pd;
+	char *name;
+	{
+	unsigned int h;
+	int off;
+
+	h = hashstr(name) & (pd->hashsize - 1);
+	while ((off = pd->hash[h]) != 0) {
+		if (equal(pd->names + off - 1, name))
+			return 1;
+		h = (h + 1) & (pd->hashsize - 1);
+	}
+	return 0;
+}
+
+
+
+
 /*
  * Delete all functions.
  */
@@ -660,21 +906,16 @@ SHELLPROC {
 
 void
 deletefuncs() {
-	struct tblentry **tblp;
-	struct tblentry **pp;
+	struct hashent *hp;
 	struct tblentry *cmdp;
 
 	INTOFF;
-	for (tblp = cmdtable ; tblp < &cmdtable[CMDTABLESIZE] ; tblp++) {
-		pp = tblp;
-		while ((cmdp = *pp) != NULL) {
-			if (cmdp->cmdtype == CMDFUNCTION) {
-				*pp = cmdp->next;
-				freefunc(cmdp->param.func);
-				ckfree(cmdp);
-			} else {
-				pp = &cmdp->next;
-			}
+	HTFOREACH(hp, &cmdtable) {
+		cmdp = hp->ent;
+		if (cmdp->cmdtype == CMDFUNCTION) {
+			htdelete(&cmdtable, hp);
+			freefunc(cmdp->param.func);
+			ckfree(cmdp);
 		}
 	}
 	INTON;
@@ -685,12 +926,11 @@ deletefuncs() {
 /*
  * Locate a command in the command hash table.  If "add" is nonzero,
  * add the command to the table if it is not already present.  The
- * variable "lastcmdentry" is set to point to the address of the link
- * pointing to the entry, so that delete_cmd_entry can delete the
- * entry.
+ * variable "lastcmdentry" is set to point to the slot holding the entry,
+ * so that delete_cmd_entry can delete the entry.
  */
 
-struct tblentry **lastcmdentry;
+struct hashent *lastcmdentry;
 
 
 STATIC struct tblentry *
@@ -698,36 +938,38 @@ cmdlookup(name, add)
 	char *name;
 	int add;
 {
-	int hashval;
-	register char *p;
+	unsigned hashval;
 	struct tblentry *cmdp;
-	struct tblentry **pp;
-
-	p = name;
-	hashval = *p << 4;
-	while (*p)
-		hashval += *p++;
-	hashval &= 0x7FFF;
-	pp = &cmdtable[hashval % CMDTABLESIZE];
-	for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
-		if (equal(cmdp->cmdname, name))
-			break;
-		pp = &cmdp->next;
-	}
-	if (add && cmdp == NULL) {
+	struct hashent *hp;
+
+	hashval = hashstr(name);
+	if ((hp = htlookup(&cmdtable, name, hashval)) != NULL) {
+		cmdp = hp->ent;
+	} else if (add) {
 		INTOFF;
-		cmdp = *pp = ckmalloc(sizeof (struct tblentry) - ARB
+		cmdp = ckmalloc(sizeof (struct tblentry) - ARB
 					+ strlen(name) + 1);
-		cmdp->next = NULL;
 		cmdp->cmdtype = CMDUNKNOWN;
 		cmdp->rehash = 0;
 		strcpy(cmdp->cmdname, name);
+		hp = htadd(&cmdtable, cmdp, hashval);
 		INTON;
+	} else {
+		cmdp = NULL;
 	}
-	lastcmdentry = pp;
+	lastcmdentry = hp;
 	return cmdp;
 }
 
+
+STATIC int
+cmdmatch(ent, name)
+	void *ent;
+	const char *name;
+	{
+	return equal(((struct tblentry *)ent)->cmdname, name);
+}
+
 /*
  * Delete the command entry returned on the last lookup.
  */
@@ -737,8 +979,8 @@ delete_cmd_entry() {
 	struct tblentry *cmdp;
 
 	INTOFF;
-	cmdp = *lastcmdentry;
-	*lastcmdentry = cmdp->next;
+	cmdp = lastcmdentry->ent;
+	htdelete(&cmdtable, lastcmdentry);
 	ckfree(cmdp);
 	INTON;
 }
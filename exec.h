@@ -53,6 +53,7 @@ struct cmdentry {
 
 
 extern char *pathopt;		/* set by padvance */
+extern int filegen;		/* bumped when we may have made a file */
 
 void shellexec __P((char **, char **, char *, int));
 char *padvance __P((char **, char *));
@@ -72,6 +72,17 @@ static char sccsid[] = "@(#)expand.c	8.5 (Berkeley) 5/15/95";
 #include "redir.h"
 #include "show.h"
 
+/*
+ * Command substitution output is read BACKQBUFSIZ bytes at a time, the
+ * capacity of a pipe, and scanned a bqword at a time (see backqcopy).
+ */
+
+#define BACKQBUFSIZ 65536
+
+typedef unsigned long bqword;
+#define BQONES	((bqword)-1 / 0xff)		/* 0x0101...01 */
+#define BQHIGHS	(BQONES << 7)			/* 0x8080...80 */
+
 /*
  * Structure specifying which parts of the string should be searched
  * for IFS characters.
@@ -116,8 +127,12 @@ closeprocsubstfds(void)
 }
 STATIC char *exptilde __P((char *, int));
 STATIC void expbackq __P((union node *, int, int));
+STATIC char *backqcopy __P((char *, int, char *, char const *, int));
 STATIC int subevalvar __P((char *, char *, int, int, int));
+STATIC char *trimstr __P((char *, char *, char *, int));
 STATIC char *evalvar __P((char *, int));
+STATIC char *subscript __P((char *, char *, int *, char **));
+STATIC void arrayvalue __P((char *, int, int, int, int, char *));
 STATIC int varisset __P((int));
 STATIC void varvalue __P((int, int, int));
 STATIC void recordregion __P((int, int, int));
@@ -348,6 +363,7 @@ expari(flag)
 	char *p, *start;
 	int result;
 	int quotes = flag & (EXP_FULL | EXP_CASE);
+	char buf[ARITH_MAX_LEN];
 
 	/*
 	 * This routine is slightly over-compilcated for
@@ -359,7 +375,7 @@ expari(flag)
 	 * have to rescan starting from the beginning since CTLESC
 	 * characters have to be processed left to right.  
 	 */
-	CHECKSTRSPACE(8, expdest);
+	CHECKSTRSPACE(ARITH_MAX_LEN, expdest);
 	USTPUTC('\0', expdest); 
 	start = stackblock();
 	p = expdest;
@@ -373,8 +389,7 @@ expari(flag)
 				p++;
 	if (quotes)
 		rmescapes(p+1);
-	result = arith(p+1);
-	fmtstr(p, 10, "%d", result);
+	scopy(fmtarith(arith(p+1), buf), p);
 	while (*p++)
 		;
 	result = expdest - p + 1;
@@ -457,12 +472,11 @@ expbackq(cmd, quoted, flag)
 {
 	struct backcmd in;
 	int i;
-	char buf[128];
+	char *buf;
 	char *p;
 	char *dest = expdest;
 	struct ifsregion saveifs, *savelastp;
 	struct nodelist *saveargbackq;
-	char lastc;
 	int startloc = dest - stackblock();
 	char const *syntax = quoted? DQSYNTAX : BASESYNTAX;
 	int saveherefd;
@@ -482,29 +496,24 @@ expbackq(cmd, quoted, flag)
 	argbackq = saveargbackq;
 	herefd = saveherefd;
 
-	p = in.buf;
-	lastc = '\0';
-	for (;;) {
-		if (--in.nleft < 0) {
-			if (in.fd < 0)
-				break;
-			while ((i = read(in.fd, buf, sizeof buf)) < 0 && errno == EINTR);
+	if (in.nleft > 0)
+		dest = backqcopy(in.buf, in.nleft, dest, syntax, quotes);
+	if (in.fd >= 0) {
+		buf = ckmalloc(BACKQBUFSIZ);
+		for (;;) {
+			while ((i = read(in.fd, buf, BACKQBUFSIZ)) < 0
+			    && errno == EINTR);
 			TRACE(("expbackq: read returns %d\n", i));
 			if (i <= 0)
 				break;
-			p = buf;
-			in.nleft = i - 1;
-		}
-		lastc = *p++;
-		if (lastc != '\0') {
-			if (quotes && syntax[lastc] == CCTL)
-				STPUTC(CTLESC, dest);
-			STPUTC(lastc, dest);
+			dest = backqcopy(buf, i, dest, syntax, quotes);
 		}
+		ckfree(buf);
 	}
 
 	/* Eat all trailing newlines */
-	for (p--; lastc == '\n'; lastc = *--p)
+	p = stackblock() + startloc;
+	while (dest > p && dest[-1] == '\n')
 		STUNPUTC(dest);
 
 	if (in.fd >= 0)
@@ -525,6 +534,61 @@ expbackq(cmd, quoted, flag)
 
 
 
+/*
+ * Append the output of a command substitution to the string being
+ * built at dest.  Nul bytes are dropped, and if quotes is set the
+ * characters that are CCTL in syntax get a CTLESC.  Both are rare, so
+ * we look for runs of ordinary bytes (a word at a time where the only
+ * CCTL characters are the CTL codes, which have the top bit set) and
+ * copy each run with memcpy after reserving room for the worst case.
+ */
+
+STATIC char *
+backqcopy(p, len, dest, syntax, quotes)
+	char *p;
+	int len;
+	char *dest;
+	char const *syntax;
+	int quotes;
+	{
+	char *end = p + len;
+	char *q;
+	bqword w;
+	int n;
+
+	while (sstrnleft < 2 * len)
+		dest = makestrspace();
+	while (p < end) {
+		if (! quotes) {
+			if ((q = memchr(p, '\0', end - p)) == NULL)
+				q = end;
+		} else {
+			q = p;
+			if (syntax == BASESYNTAX) {
+				while (end - q >= sizeof w) {
+					memcpy(&w, q, sizeof w);
+					if (((w - BQONES) | w) & BQHIGHS)
+						break;
+					q += sizeof w;
+				}
+			}
+			while (q < end && *q != '\0' && syntax[*q] != CCTL)
+				q++;
+		}
+		n = q - p;
+		memcpy(dest, p, n);
+		STADJUST(n, dest);
+		if (q == end)
+			break;
+		if (*q != '\0')
+			USTPUTC(CTLESC, dest), USTPUTC(*q, dest);
+		p = q + 1;
+	}
+	return dest;
+}
+
+
+
 STATIC int
 subevalvar(p, str, subtype, startloc, varflags)
 	char *p;
@@ -537,8 +601,11 @@ subevalvar(p, str, subtype, startloc, varflags)
 	char *startp;
 	char *loc;
 	int c = 0;
+	int patloc = 0;
 	int saveherefd = herefd;
 	struct nodelist *saveargbackq = argbackq;
+	if (subtype >= VSTRIMLEFT)	/* the pattern follows the value */
+		patloc = str - stackblock();
 	herefd = -1;
 	argstr(p, 0);
 	STACKSTRNUL(expdest);
@@ -560,63 +627,76 @@ subevalvar(p, str, subtype, startloc, varflags)
 			outfmt(&errout, "%s\n", startp);
 			error((char *)NULL);
 		}
-		error("%.*s: parameter %snot set", p - str - 1,
+		error("%.*s: parameter %snot set", strchr(str, '=') - str,
 		      str, (varflags & VSNUL) ? "null or "
 					      : nullstr);
 		return 0;
 
 	case VSTRIMLEFT:
-		for (loc = startp; loc < str - 1; loc++) {
-			c = *loc;
-			*loc = '\0';
-			if (patmatch(str, startp)) {
-				*loc = c;
-				goto recordleft;
-			}
-			*loc = c;
-		}
-		return 0;
+	case VSTRIMLEFTMAX:
+	case VSTRIMRIGHT:
+	case VSTRIMRIGHTMAX:
+		str = stackblock() + patloc;	/* argstr may move the block */
+		loc = trimstr(str, startp, str - 1, subtype);
+		c = loc - expdest;
+		STADJUST(c, expdest);
+		return 1;
+
+	default:
+		abort();
+	}
+}
+
+
+/*
+ * Remove the part of the string from startp to the null at end which
+ * pat matches, as ${var#pat} and the like do, and return the new end.
+ */
 
+STATIC char *
+trimstr(pat, startp, end, subtype)
+	char *pat;
+	char *startp;
+	char *end;
+	int subtype;
+{
+	char *loc;
+	int c;
+
+	switch (subtype) {
+	case VSTRIMLEFT:
 	case VSTRIMLEFTMAX:
-		for (loc = str - 1; loc >= startp; loc--) {
+		loc = subtype == VSTRIMLEFT ? startp : end;
+		for (;;) {
 			c = *loc;
 			*loc = '\0';
-			if (patmatch(str, startp)) {
+			if (patmatch(pat, startp)) {
 				*loc = c;
-				goto recordleft;
+				memmove(startp, loc, end - loc);
+				return startp + (end - loc);
 			}
 			*loc = c;
+			if (loc == (subtype == VSTRIMLEFT ? end : startp))
+				return end;
+			loc += subtype == VSTRIMLEFT ? 1 : -1;
 		}
-		return 0;
 
 	case VSTRIMRIGHT:
-		for (loc = str - 1; loc >= startp; loc--) {
-			if (patmatch(str, loc)) {
-				expdest = loc;
-				return 1;
-			}
-		}
-		return 0;
-
 	case VSTRIMRIGHTMAX:
-		for (loc = startp; loc < str - 1; loc++) {
-			if (patmatch(str, loc)) {
-				expdest = loc;
-				return 1;
-			}
+		loc = subtype == VSTRIMRIGHT ? end : startp;
+		for (;;) {
+			if (patmatch(pat, loc))
+				return loc;
+			if (loc == (subtype == VSTRIMRIGHT ? startp : end))
+				return end;
+			loc += subtype == VSTRIMRIGHT ? -1 : 1;
 		}
-		return 0;
-
 
 	default:
 		abort();
 	}
-
-recordleft:
-	expdest = (str - 1) - (loc - startp);
-	while (loc != str - 1)
-		*startp++ = *loc++;
-	return 1;
+	/*NOTREACHED*/
+	return end;
 }
 
 
@@ -641,6 +721,8 @@ evalvar(p, flag)
 	int startloc;
 	int varlen;
 	int easy;
+	int whole;
+	char *elemval;
 	int quotes = flag & (EXP_FULL | EXP_CASE);
 
 	varflags = *p++;
@@ -650,12 +732,25 @@ evalvar(p, flag)
 	if (! is_name(*p))
 		special = 1;
 	p = strchr(p, '=') + 1;
+	whole = 0;
+	if (varflags & VSARRAY) {
+		p = subscript(p, var, &whole, &elemval);
+		if (subtype == VSASSIGN || (!whole && subtype == VSKEYS))
+			error("%.*s: bad substitution", strchr(var, '=') - var,
+			    var);
+	}
 again: /* jump here after setting a variable with ${var=text} */
 	if (special) {
 		set = varisset(*var);
 		val = NULL;
+	} else if (whole) {
+		set = arraycount(var) != 0;
+		val = NULL;
 	} else {
-		val = lookupvar(var);
+		if (varflags & VSARRAY)
+			val = elemval;
+		else
+			val = lookupvarref(var);
 		if (val == NULL || ((varflags & VSNUL) && val[0] == '\0')) {
 			val = NULL;
 			set = 0;
@@ -672,8 +767,14 @@ again: /* jump here after setting a variable with ${var=text} */
 			if (subtype == VSLENGTH) {
 				for (exp = oexpdest;exp != expdest; exp++)
 					varlen++;
-				expdest = oexpdest;
+				STADJUST(-varlen, expdest);
 			}
+		} else if (whole) {
+			if (subtype == VSLENGTH)
+				varlen = arraycount(var);
+			else
+				arrayvalue(var, whole, varflags & VSQUOTE,
+				    flag, subtype, p);
 		} else {
 			char const *syntax = (varflags & VSQUOTE) ? DQSYNTAX 
 								  : BASESYNTAX;
@@ -697,7 +798,7 @@ again: /* jump here after setting a variable with ${var=text} */
 		set = ! set;
 
 	easy = ((varflags & VSQUOTE) == 0 || 
-		(*var == '@' && shellparam.nparam != 1));
+		(*var == '@' && shellparam.nparam != 1) || whole == '@');
 
 
 	switch (subtype) {
@@ -706,11 +807,12 @@ again: /* jump here after setting a variable with ${var=text} */
 		goto record;
 
 	case VSNORMAL:
+	case VSKEYS:
 		if (!easy)
 			break;
 record:
 		recordregion(startloc, expdest - stackblock(), 
-			     varflags & VSQUOTE);
+			     (varflags & VSQUOTE) || whole == '@');
 		break;
 
 	case VSPLUS:
@@ -729,6 +831,8 @@ record:
 	case VSTRIMRIGHTMAX:
 		if (!set)
 			break;
+		if (whole)		/* trimmed by arrayvalue */
+			goto record;
 		/*
 		 * Terminate the string and start recording the pattern
 		 * right after it
@@ -763,7 +867,10 @@ record:
 				if (set)
 					argbackq = argbackq->next;
 			} else if (c == CTLVAR) {
-				if ((*p++ & VSTYPE) != VSNORMAL)
+				c = *p++;
+				if ((c & VSTYPE) != VSNORMAL)
+					nesting++;
+				if (c & VSARRAY)	/* the subscript */
 					nesting++;
 			} else if (c == CTLENDVAR) {
 				if (--nesting == 0)
@@ -776,6 +883,135 @@ record:
 
 
 
+/*
+ * Expand the subscript of ${name[subscript]}, which starts at p and
+ * ends with CTLENDVAR, and return the position after it.  A subscript
+ * of @ or * selects the whole array and is returned in *wholep;
+ * otherwise the element it selects is looked up and put in *valp.
+ */
+
+STATIC char *
+subscript(p, name, wholep, valp)
+	char *p;
+	char *name;
+	int *wholep;
+	char **valp;
+{
+	char *q;
+	int startloc;
+	int nesting;
+	int c;
+
+	startloc = expdest - stackblock();
+	argstr(p, 0);
+	STACKSTRNUL(expdest);
+	q = stackblock() + startloc;
+	if ((*q == '@' || *q == '*') && q[1] == '\0')
+		*wholep = *q;
+	else
+		*valp = lookupsub(name, q);
+	c = stackblock() + startloc - expdest;
+	STADJUST(c, expdest);
+	nesting = 1;
+	for (;;) {
+		if ((c = *p++) == CTLESC)
+			p++;
+		else if (c == CTLVAR) {
+			c = *p++;
+			if ((c & VSTYPE) != VSNORMAL)
+				nesting++;
+			if (c & VSARRAY)
+				nesting++;
+		} else if (c == CTLENDVAR && --nesting == 0)
+			break;
+	}
+	return p;
+}
+
+
+
+/*
+ * Add the elements of an array, or their subscripts for ${!name[@]},
+ * to the stack string in the manner of $@ and $*.  The elements of
+ * ${name[@]} are separated by nulls, which are the only characters
+ * recordregion is told to split them at.  For ${name[@]#pat} and the
+ * like, pat is expanded in front of the elements, each element is
+ * trimmed as it is added, and the pattern is removed at the end.
+ */
+
+STATIC void
+arrayvalue(name, whole, quoted, flag, subtype, pat)
+	char *name;
+	int whole;
+	int quoted;
+	int flag;
+	int subtype;
+	char *pat;
+{
+	char const *syntax;
+	char *p;
+	char *key;
+	int sep;
+	int first;
+	int pos;
+	int trim;
+	int patloc, patlen, elemloc;
+	int len;
+	int saveherefd;
+	struct nodelist *saveargbackq;
+
+	syntax = quoted ? DQSYNTAX : BASESYNTAX;
+	sep = whole == '@' && (flag & EXP_FULL) ? '\0' : ' ';
+	trim = subtype >= VSTRIMLEFT && subtype <= VSTRIMRIGHTMAX;
+	patloc = expdest - stackblock();
+	if (trim) {
+		saveherefd = herefd;
+		saveargbackq = argbackq;
+		herefd = -1;
+		argstr(pat, 0);
+		STPUTC('\0', expdest);
+		herefd = saveherefd;
+		argbackq = saveargbackq;
+	}
+	elemloc = expdest - stackblock();
+	pos = 0;
+	first = 1;
+	while ((p = nextelem(name, &pos, &key)) != NULL) {
+		if (! first)
+			STPUTC(sep, expdest);
+		first = 0;
+		if (subtype == VSKEYS && key == NULL) {
+			expdest = cvtnum(pos - 1, expdest);
+			continue;
+		}
+		if (subtype == VSKEYS)
+			p = key;
+		if (trim)
+			elemloc = expdest - stackblock();
+		while (*p) {
+			if ((flag & (EXP_FULL | EXP_CASE))
+			 && syntax[*p] == CCTL)
+				STPUTC(CTLESC, expdest);
+			STPUTC(*p++, expdest);
+		}
+		if (trim) {
+			STACKSTRNUL(expdest);
+			p = trimstr(stackblock() + patloc,
+			    stackblock() + elemloc, expdest, subtype);
+			len = p - expdest;
+			STADJUST(len, expdest);
+		}
+	}
+	if (trim) {
+		p = stackblock() + patloc;
+		patlen = strlen(p) + 1;
+		memmove(p, p + patlen, expdest - (p + patlen));
+		STADJUST(-patlen, expdest);
+	}
+}
+
+
+
 /*
  * Test whether a specialized variable is set.
  */
@@ -0,0 +1,216 @@
+/*-
+ * Copyright (c) 1993
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * This code is derived from software contributed to Berkeley by
+ * Kenneth Almquist.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *	This product includes software developed by the University of
+ *	California, Berkeley and its contributors.
+ * 4. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Open addressing hash tables with linear probing.  The hash of each
+ * entry is kept in its slot, so a probe only calls the match routine
+ * when the full hash agrees.  Deleted slots are marked rather than
+ * emptied so that later probes still find what lies beyond them; the
+ * table is rebuilt without them when it gets three quarters full.
+ */
+
+#include <stdlib.h>
+#include "shell.h"
+#include "hashtab.h"
+#include "memalloc.h"
+#include "error.h"
+
+#define HTMINSIZE 16
+
+char htdeleted;
+
+STATIC void htresize __P((struct hashtab *));
+
+
+/*
+ * FNV-1a.  The hash stops at an '=' so that a name=value string hashes
+ * the same as the name.
+ */
+
+unsigned
+hashstr(p)
+	const char *p;
+	{
+	unsigned h;
+
+	h = 2166136261U;
+	while (*p && *p != '=')
+		h = (h ^ (unsigned char)*p++) * 16777619U;
+	return h;
+}
+
+
+/*
+ * FNV-1a over the whole string, for keys which may contain '='.
+ */
+
+unsigned
+hashkey(p)
+	const char *p;
+	{
+	unsigned h;
+
+	h = 2166136261U;
+	while (*p)
+		h = (h ^ (unsigned char)*p++) * 16777619U;
+	return h;
+}
+
+
+/*
+ * Return the slot holding the entry called name, or NULL.
+ */
+
+struct hashent *
+htlookup(tp, name, hash)
+	struct hashtab *tp;
+	const char *name;
+	unsigned hash;
+	{
+	struct hashent *hp;
+	unsigned mask;
+	unsigned i;
+
+	if (tp->size == 0)
+		return NULL;
+	mask = tp->size - 1;
+	for (i = hash & mask ; (hp = &tp->tab[i])->ent != NULL ; i = (i + 1) & mask) {
+		if (hp->hash == hash && hp->ent != HTDELETED
+		 && (*tp->match)(hp->ent, name))
+			return hp;
+	}
+	return NULL;
+}
+
+
+/*
+ * Add an entry, which must not already be in the table, and return its
+ * slot.  The slot stays valid until the next call to htadd.
+ */
+
+struct hashent *
+htadd(tp, ent, hash)
+	struct hashtab *tp;
+	void *ent;
+	unsigned hash;
+	{
+	struct hashent *hp;
+	unsigned mask;
+	unsigned i;
+
+	INTOFF;
+	if ((tp->nused + 1) * 4 > tp->size * 3)
+		htresize(tp);
+	mask = tp->size - 1;
+	for (i = hash & mask ; HTLIVE(&tp->tab[i]) ; i = (i + 1) & mask);
+	hp = &tp->tab[i];
+	if (hp->ent == NULL)
+		tp->nused++;
+	tp->nent++;
+	hp->hash = hash;
+	hp->ent = ent;
+	INTON;
+	return hp;
+}
+
+
+/*
+ * Remove the entry in a slot returned by htlookup or htadd.  The entry
+ * itself is up to the caller.  Slots may be deleted while walking the
+ * table with HTFOREACH.
+ */
+
+void
+htdelete(tp, hp)
+	struct hashtab *tp;
+	struct hashent *hp;
+	{
+	hp->ent = HTDELETED;
+	tp->nent--;
+}
+
+
+/*
+ * Remove all the entries.
+ */
+
+void
+htclear(tp)
+	struct hashtab *tp;
+	{
+	INTOFF;
+	if (tp->tab)
+		ckfree(tp->tab);
+	tp->tab = NULL;
+	tp->size = tp->nent = tp->nused = 0;
+	INTON;
+}
+
+
+/*
+ * Rebuild the table, dropping the deleted slots, so that it is at most
+ * half full with one more entry in it.
+ */
+
+STATIC void
+htresize(tp)
+	struct hashtab *tp;
+	{
+	struct hashent *old, *hp, *np;
+	int oldsize;
+	int size;
+	unsigned mask;
+	unsigned i;
+
+	for (size = HTMINSIZE ; size < (tp->nent + 1) * 2 ; size <<= 1);
+	old = tp->tab;
+	oldsize = tp->size;
+	tp->tab = ckmalloc(size * sizeof *tp->tab);
+	for (i = 0 ; i < size ; i++)
+		tp->tab[i].ent = NULL;
+	tp->size = size;
+	tp->nused = tp->nent;
+	mask = size - 1;
+	for (hp = old ; hp < old + oldsize ; hp++) {
+		if (! HTLIVE(hp))
+			continue;
+		for (i = hp->hash & mask ; tp->tab[i].ent != NULL ; i = (i + 1) & mask);
+		np = &tp->tab[i];
+		*np = *hp;
+	}
+	if (old)
+		ckfree(old);
+}
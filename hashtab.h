@@ -0,0 +1,76 @@
+/*-
+ * Copyright (c) 1993
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * This code is derived from software contributed to Berkeley by
+ * Kenneth Almquist.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *	This product includes software developed by the University of
+ *	California, Berkeley and its contributors.
+ * 4. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HASHTAB_INCL
+
+/*
+ * Open addressing hash tables, shared by the command, variable and alias
+ * tables.  A table holds pointers to entries owned by the caller; the
+ * match routine tells whether an entry has a given name.
+ */
+
+struct hashent {
+	unsigned hash;		/* hash of the entry's name */
+	void *ent;		/* the entry, NULL or HTDELETED */
+};
+
+struct hashtab {
+	int (*match) __P((void *, const char *));
+	int size;		/* number of slots, a power of two */
+	int nent;		/* live entries */
+	int nused;		/* live entries plus deleted slots */
+	struct hashent *tab;
+};
+
+extern char htdeleted;
+
+#define HTDELETED	((void *)&htdeleted)
+#define HTLIVE(hp)	((hp)->ent != NULL && (hp)->ent != HTDELETED)
+
+/* loop over the live slots of a table */
+#define HTFOREACH(hp, tp) \
+	for ((hp) = (tp)->tab ; (hp) < (tp)->tab + (tp)->size ; (hp)++) \
+		if (HTLIVE(hp))
+
+unsigned hashstr __P((const char *));
+unsigned hashkey __P((const char *));
+struct hashent *htlookup __P((struct hashtab *, const char *, unsigned));
+struct hashent *htadd __P((struct hashtab *, void *, unsigned));
+void htdelete __P((struct hashtab *, struct hashent *));
+void htclear __P((struct hashtab *));
+
+#define HASHTAB_INCL
+#endif
@@ -44,6 +44,7 @@ static char sccsid[] = "@(#)input.c	8.3 (Berkeley) 6/9/95";
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 /*
  * This file implements the input routines used by the parser.
@@ -502,6 +503,42 @@ done:
 	return *parsenextc++;
 }
 
+/*
+ * Return true if nothing but blanks, newlines and comments is left in
+ * the current input.  For a script this relies on fstat, so standard
+ * input (which may be a terminal or a pipe) is never said to be at end.
+ */
+
+int
+inputatend() {
+	register char *p;
+	register int n;
+	int comment;
+	struct stat statb;
+	off_t off;
+
+	if (parsefile->strpush)
+		return 0;
+	if (parsenleft <= EOF_NLEFT + 1)
+		return 1;		/* EOF read, maybe pushed back */
+	comment = 0;
+	for (p = parsenextc, n = parsenleft ; --n >= 0 ; p++) {
+		if (*p == '\n')
+			comment = 0;
+		else if (*p == '#')
+			comment = 1;
+		else if (! comment && *p != ' ' && *p != '\t')
+			return 0;
+	}
+	if (parsefile->buf == NULL)
+		return 1;		/* reading a string */
+	if (parsefile->fd <= 0 || fstat(parsefile->fd, &statb) < 0
+	 || ! S_ISREG(statb.st_mode)
+	 || (off = lseek(parsefile->fd, (off_t)0, SEEK_CUR)) < 0)
+		return 0;
+	return off >= statb.st_size;
+}
+
 /*
  * Undo the last call to pgetc.  Only one character may be pushed back.
  * PEOF may be pushed back.
@@ -603,6 +640,8 @@ setinputfd(fd, push)
 	}
 	if (parsefile->fd > 0)
 		close(parsefile->fd);
+	if (fd > 0)
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
 	parsefile->fd = fd;
 	if (parsefile->buf == NULL)
 		parsefile->buf = ckmalloc(BUFSIZ);
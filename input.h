@@ -51,6 +51,7 @@ extern int init_editline;	/* 0 == not setup, 1 == OK, -1 == failed */
 char *pfgets __P((char *, int));
 int pgetc __P((void));
 int preadbuffer __P((void));
+int inputatend __P((void));
 void pungetc __P((void));
 void pushstring __P((char *, int, void *));
 void popstring __P((void));
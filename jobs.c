@@ -43,6 +43,7 @@ static char sccsid[] = "@(#)jobs.c	8.5 (Berkeley) 5/4/95";
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <spawn.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -56,6 +57,8 @@ static char sccsid[] = "@(#)jobs.c	8.5 (Berkeley) 5/4/95";
 #include "main.h"
 #include "parser.h"
 #include "nodes.h"
+#include "eval.h"
+#include "exec.h"
 #include "jobs.h"
 #include "options.h"
 #include "trap.h"
@@ -67,20 +70,56 @@ static char sccsid[] = "@(#)jobs.c	8.5 (Berkeley) 5/4/95";
 #include "mystring.h"
 
 
-struct job *jobtab;		/* array of jobs */
-int njobs;			/* size of array */
-MKINIT short backgndpid = -1;	/* pid of last background process */
+struct job **jobtab;		/* jobs, indexed by job number - 1 */
+int njobs;			/* number of slots handed out */
+STATIC int jobtabsize;		/* allocated size of jobtab */
+STATIC int jobfree = -1;	/* index of first unused slot, or -1 */
+MKINIT int backgndpid = -1;	/* pid of last background process */
 #if JOBS
 int initialpgrp;		/* pgrp of shell on invocation */
 short curjob;			/* current job */
 #endif
+STATIC int nlive;		/* processes in jobtab still running */
+STATIC int nchanged;		/* jobs with the changed flag set */
+STATIC int nbgrun;		/* background jobs still running */
+STATIC int jobslots;		/* limit on nbgrun, 0 if none */
+STATIC struct job *donehead;	/* background jobs done but not waited for */
+STATIC struct job *donetail;
 
+/*
+ * An index from process id to process, so that dowait needs not search
+ * the whole job table for the process that the wait call returned.
+ * Process ids are handed out more or less sequentially, so the low bits
+ * of the pid spread the entries well enough.
+ */
+
+struct pident {
+	struct pident *next;
+	int pid;
+	struct job *jp;		/* job the process belongs to */
+	int procno;		/* index into the ps array of the job */
+};
+
+#define PIDTABINIT 64		/* initial number of buckets */
+
+STATIC struct pident **pidtab;	/* hash buckets, a power of 2 of them */
+STATIC int pidtabsize;
+STATIC int npids;		/* number of entries */
+
+STATIC void pidadd __P((int, struct job *, int));
+STATIC void piddelete __P((int, struct job *));
+STATIC struct pident *pidlookup __P((int));
+STATIC void forkparent __P((struct job *, union node *, int, int));
+STATIC void waitslot __P((void));
+STATIC void donelink __P((struct job *));
+STATIC void doneunlink __P((struct job *));
+STATIC int jobstatus __P((struct job *));
 STATIC void restartjob __P((struct job *));
 STATIC void freejob __P((struct job *));
 STATIC struct job *getjob __P((char *));
 STATIC int dowait __P((int, struct job *));
 STATIC int onsigchild __P((void));
-STATIC int waitproc __P((int, int *));
+STATIC int waitproc __P((int, int, int *));
 STATIC void cmdtxt __P((union node *));
 STATIC void cmdputs __P((char *));
 
@@ -172,6 +211,11 @@ fgcmd(argc, argv)
 		error("job not created under job control");
 	pgrp = jp->ps[0].pid;
 	tcsetpgrp(2, pgrp);
+	if (jp->bg) {
+		if (jp->state == 0)
+			nbgrun--;
+		jp->bg = 0;
+	}
 	restartjob(jp);
 	INTOFF;
 	status = waitforjob(jp);
@@ -191,6 +235,9 @@ bgcmd(argc, argv)
 		jp = getjob(*++argv);
 		if (jp->jobctl == 0)
 			error("job not created under job control");
+		if (! jp->bg && jp->state == 0)
+			nbgrun++;
+		jp->bg = 1;
 		restartjob(jp);
 	} while (--argc > 1);
 	return 0;
@@ -208,12 +255,15 @@ restartjob(jp)
 		return;
 	INTOFF;
 	killpg(jp->ps[0].pid, SIGCONT);
+	if (jp->state != 0 && jp->bg)
+		nbgrun++;
 	for (ps = jp->ps, i = jp->nprocs ; --i >= 0 ; ps++) {
 		if ((ps->status & 0377) == 0177) {
 			ps->status = -1;
-			jp->state = 0;
+			nlive++;
 		}
 	}
+	jp->state = 0;
 	INTON;
 }
 #endif
@@ -252,7 +302,10 @@ showjobs(change)
 
 	TRACE(("showjobs(%d) called\n", change));
 	while (dowait(0, (struct job *)NULL) > 0);
-	for (jobno = 1, jp = jobtab ; jobno <= njobs ; jobno++, jp++) {
+	if (change && nchanged == 0)
+		return;
+	for (jobno = 1 ; jobno <= njobs ; jobno++) {
+		jp = jobtab[jobno - 1];
 		if (! jp->used)
 			continue;
 		if (jp->nprocs == 0) {
@@ -298,7 +351,10 @@ showjobs(change)
 			if (--procno <= 0)
 				break;
 		}
-		jp->changed = 0;
+		if (jp->changed) {
+			jp->changed = 0;
+			nchanged--;
+		}
 		if (jp->state == JOBDONE) {
 			freejob(jp);
 		}
@@ -321,12 +377,23 @@ freejob(jp)
 	for (i = jp->nprocs, ps = jp->ps ; --i >= 0 ; ps++) {
 		if (ps->cmd != nullstr)
 			ckfree(ps->cmd);
+		if (ps->status == -1)
+			nlive--;
+		piddelete(ps->pid, jp);
 	}
-	if (jp->ps != &jp->ps0)
+	if (jp->ps != jp->ps0)
 		ckfree(jp->ps);
+	if (jp->changed)
+		nchanged--;
+	if (jp->bg && jp->state == 0)
+		nbgrun--;
+	if (jp->ondone)
+		doneunlink(jp);
 	jp->used = 0;
+	jp->nextfree = jobfree;
+	jobfree = jp->jobno - 1;
 #if JOBS
-	if (curjob == jp - jobtab + 1)
+	if (curjob == jp->jobno)
 		curjob = 0;
 #endif
 	INTON;
@@ -334,51 +401,270 @@ freejob(jp)
 
 
 
+/*
+ * Maintain the pid index.  A pid may be in the table more than once if
+ * it was reused while an old job was still around; pidadd puts the new
+ * entry first so that pidlookup finds the live process.
+ */
+
+STATIC void
+pidadd(pid, jp, procno)
+	int pid;
+	struct job *jp;
+	int procno;
+{
+	struct pident *pe, *next;
+	struct pident **old, **tail;
+	int oldsize;
+	int i;
+
+	INTOFF;
+	if (npids >= pidtabsize * 2) {
+		old = pidtab;
+		oldsize = pidtabsize;
+		pidtabsize = oldsize == 0 ? PIDTABINIT : oldsize * 2;
+		pidtab = ckmalloc(pidtabsize * sizeof pidtab[0]);
+		for (i = 0 ; i < pidtabsize ; i++)
+			pidtab[i] = NULL;
+		/* keep the order within a chain so that newer entries stay first */
+		for (i = 0 ; i < oldsize ; i++) {
+			for (pe = old[i] ; pe ; pe = next) {
+				next = pe->next;
+				tail = &pidtab[pe->pid & (pidtabsize - 1)];
+				while (*tail)
+					tail = &(*tail)->next;
+				pe->next = NULL;
+				*tail = pe;
+			}
+		}
+		if (old)
+			ckfree(old);
+	}
+	pe = ckmalloc(sizeof *pe);
+	pe->pid = pid;
+	pe->jp = jp;
+	pe->procno = procno;
+	pe->next = pidtab[pid & (pidtabsize - 1)];
+	pidtab[pid & (pidtabsize - 1)] = pe;
+	npids++;
+	INTON;
+}
+
+
+STATIC void
+piddelete(pid, jp)
+	int pid;
+	struct job *jp;
+{
+	struct pident *pe, **pep;
+
+	if (pidtabsize == 0)
+		return;
+	for (pep = &pidtab[pid & (pidtabsize - 1)] ; (pe = *pep) != NULL ;
+	    pep = &pe->next) {
+		if (pe->pid == pid && pe->jp == jp) {
+			*pep = pe->next;
+			ckfree(pe);
+			npids--;
+			return;
+		}
+	}
+}
+
+
+STATIC struct pident *
+pidlookup(pid)
+	int pid;
+{
+	struct pident *pe;
+
+	if (pidtabsize == 0)
+		return NULL;
+	for (pe = pidtab[pid & (pidtabsize - 1)] ; pe ; pe = pe->next)
+		if (pe->pid == pid)
+			return pe;
+	return NULL;
+}
+
+
+
+/*
+ * The wait builtin.  With the -n option it returns as soon as any one
+ * background job (or any of the jobs named) has completed, taking jobs
+ * that completed earlier and were not waited for first, in the order
+ * they finished.
+ */
+
 int
 waitcmd(argc, argv) 
 	int argc;
 	char **argv; 
 {
 	struct job *job;
-	int status;
 	struct job *jp;
-
-	if (argc > 1) {
-		job = getjob(argv[1]);
+	char **ap;
+	int any;
+	int status;
+	int running;
+
+	any = 0;
+	while (nextopt("n") != '\0')
+		any = 1;
+	if (any) {
+		for (;;) {
+			running = 0;
+			jp = NULL;
+			if (*argptr == NULL) {
+				jp = donehead;
+				running = nbgrun > 0;
+			}
+			for (ap = argptr ; *ap && jp == NULL ; ap++) {
+				job = getjob(*ap);
+				if (job->state == JOBDONE)
+					jp = job;
+				else if (job->state == 0)
+					running = 1;
+			}
+			if (jp != NULL) {
+				status = jobstatus(jp);
+				if (! iflag)
+					freejob(jp);
+				else if (jp->ondone)
+					doneunlink(jp);
+				return status;
+			}
+			if (! running || dowait(1, (struct job *)NULL) < 0)
+				return 127;
+		}
+	}
+	if (*argptr != NULL) {
+		job = getjob(*argptr);
 	} else {
 		job = NULL;
 	}
 	for (;;) {	/* loop until process terminated or stopped */
 		if (job != NULL) {
 			if (job->state) {
-				status = job->ps[job->nprocs - 1].status;
-				if ((status & 0xFF) == 0)
-					status = status >> 8 & 0xFF;
-#if JOBS
-				else if ((status & 0xFF) == 0177)
-					status = (status >> 8 & 0x7F) + 128;
-#endif
-				else
-					status = (status & 0x7F) + 128;
+				status = jobstatus(job);
 				if (! iflag)
 					freejob(job);
 				return status;
 			}
+			if (dowait(1, job) < 0)
+				error("wait failed, errno=%d", errno);
 		} else {
-			for (jp = jobtab ; ; jp++) {
-				if (jp >= jobtab + njobs) {	/* no running procs */
-					return 0;
-				}
-				if (jp->used && jp->state == 0)
-					break;
+			if (nlive > 0 && dowait(1, (struct job *)NULL) >= 0)
+				continue;
+			/* all processes are known now, forget them */
+			while ((jp = donehead) != NULL) {
+				if (! iflag)
+					freejob(jp);
+				else
+					doneunlink(jp);
 			}
+			return 0;
 		}
-		dowait(1, (struct job *)NULL);
 	}
 }
 
 
 
+/*
+ * The jobslots builtin.  With an operand, limit the number of background
+ * jobs that run at once; starting another one then waits until one of
+ * them has finished.  Zero means no limit.  Without an operand, print
+ * the limit.
+ */
+
+int
+jobslotscmd(argc, argv)
+	int argc;
+	char **argv;
+{
+	if (argc == 1) {
+		out1fmt("%d\n", jobslots);
+		return 0;
+	}
+	jobslots = number(argv[1]);
+	return 0;
+}
+
+
+
+/*
+ * Wait until a background job can be started under the jobslots limit.
+ */
+
+STATIC void
+waitslot() {
+	while (jobslots > 0 && nbgrun >= jobslots) {
+		if (dowait(1, (struct job *)NULL) <= 0)
+			break;
+	}
+}
+
+
+
+/*
+ * The list of background jobs that have completed but have not been
+ * waited for, oldest first, for wait -n.
+ */
+
+STATIC void
+donelink(jp)
+	struct job *jp;
+{
+	jp->donenext = NULL;
+	jp->doneprev = donetail;
+	if (donetail)
+		donetail->donenext = jp;
+	else
+		donehead = jp;
+	donetail = jp;
+	jp->ondone = 1;
+}
+
+
+STATIC void
+doneunlink(jp)
+	struct job *jp;
+{
+	if (jp->doneprev)
+		jp->doneprev->donenext = jp->donenext;
+	else
+		donehead = jp->donenext;
+	if (jp->donenext)
+		jp->donenext->doneprev = jp->doneprev;
+	else
+		donetail = jp->doneprev;
+	jp->ondone = 0;
+}
+
+
+
+/*
+ * Return the exit status of a job that has stopped or completed, as it
+ * would appear in $?.
+ */
+
+STATIC int
+jobstatus(jp)
+	struct job *jp;
+{
+	int status;
+
+	status = jp->ps[jp->nprocs - 1].status;
+	if ((status & 0xFF) == 0)
+		return status >> 8 & 0xFF;
+#if JOBS
+	if ((status & 0xFF) == 0177)
+		return (status >> 8 & 0x7F) + 128;
+#endif
+	return (status & 0x7F) + 128;
+}
+
+
+
 int
 jobidcmd(argc, argv)  
 	int argc;
@@ -413,9 +699,9 @@ getjob(name)
 	if (name == NULL) {
 #if JOBS
 currentjob:
-		if ((jobno = curjob) == 0 || jobtab[jobno - 1].used == 0)
+		if ((jobno = curjob) == 0 || jobtab[jobno - 1]->used == 0)
 			error("No current job");
-		return &jobtab[jobno - 1];
+		return jobtab[jobno - 1];
 #else
 		error("No current job");
 #endif
@@ -423,15 +709,16 @@ currentjob:
 		if (is_digit(name[1])) {
 			jobno = number(name + 1);
 			if (jobno > 0 && jobno <= njobs
-			 && jobtab[jobno - 1].used != 0)
-				return &jobtab[jobno - 1];
+			 && jobtab[jobno - 1]->used != 0)
+				return jobtab[jobno - 1];
 #if JOBS
 		} else if (name[1] == '%' && name[2] == '\0') {
 			goto currentjob;
 #endif
 		} else {
 			register struct job *found = NULL;
-			for (jp = jobtab, i = njobs ; --i >= 0 ; jp++) {
+			for (i = 0 ; i < njobs ; i++) {
+				jp = jobtab[i];
 				if (jp->used && jp->nprocs > 0
 				 && prefix(name + 1, jp->ps[0].cmd)) {
 					if (found)
@@ -443,10 +730,12 @@ currentjob:
 				return found;
 		}
 	} else if (is_number(name)) {
+		struct pident *pe;
+
 		pid = number(name);
-		for (jp = jobtab, i = njobs ; --i >= 0 ; jp++) {
-			if (jp->used && jp->nprocs > 0
-			 && jp->ps[jp->nprocs - 1].pid == pid)
+		if ((pe = pidlookup(pid)) != NULL) {
+			jp = pe->jp;
+			if (pe->procno == jp->nprocs - 1)
 				return jp;
 		}
 	}
@@ -458,7 +747,10 @@ currentjob:
 
 
 /*
- * Return a new job structure,
+ * Return a new job structure.  Unused slots are kept on a list and
+ * reused first; otherwise the table of job pointers is doubled when it
+ * fills up.  Job structures never move, and the procstats of pipelines
+ * of up to NPSINLINE processes are kept in the job itself.
  */
 
 struct job *
@@ -466,47 +758,40 @@ makejob(node, nprocs)
 	union node *node;
 	int nprocs;
 {
-	int i;
 	struct job *jp;
 
-	for (i = njobs, jp = jobtab ; ; jp++) {
-		if (--i < 0) {
-			INTOFF;
-			if (njobs == 0) {
-				jobtab = ckmalloc(4 * sizeof jobtab[0]);
-			} else {
-				jp = ckmalloc((njobs + 4) * sizeof jobtab[0]);
-				memcpy(jp, jobtab, njobs * sizeof jp[0]);
-				ckfree(jobtab);
-				jobtab = jp;
-			}
-			jp = jobtab + njobs;
-			for (i = 4 ; --i >= 0 ; jobtab[njobs++].used = 0)
-				continue;
-			INTON;
-			break;
+	INTOFF;
+	if (jobfree >= 0) {
+		jp = jobtab[jobfree];
+		jobfree = jp->nextfree;
+	} else {
+		if (njobs == jobtabsize) {
+			jobtabsize = jobtabsize == 0 ? 4 : jobtabsize * 2;
+			jobtab = ckrealloc(jobtab, jobtabsize * sizeof jobtab[0]);
 		}
-		if (jp->used == 0)
-			break;
+		jp = ckmalloc(sizeof *jp);
+		jobtab[njobs++] = jp;
+		jp->jobno = njobs;
 	}
-	INTOFF;
 	jp->state = 0;
 	jp->used = 1;
 	jp->changed = 0;
+	jp->bg = 0;
+	jp->ondone = 0;
 	jp->nprocs = 0;
 #if JOBS
 	jp->jobctl = jobctl;
 #endif
-	if (nprocs > 1) {
+	if (nprocs > NPSINLINE) {
 		jp->ps = ckmalloc(nprocs * sizeof (struct procstat));
 	} else {
-		jp->ps = &jp->ps0;
+		jp->ps = jp->ps0;
 	}
 	INTON;
 	TRACE(("makejob(0x%lx, %d) returns %%%d\n", (long)node, nprocs,
-	    jp - jobtab + 1));
+	    jp->jobno));
 	return jp;
-}	
+}
 
 
 /*
@@ -533,8 +818,10 @@ forkshell(jp, n, mode)
 	int pid;
 	int pgrp;
 
-	TRACE(("forkshell(%%%d, 0x%lx, %d) called\n", jp - jobtab, (long)n,
-	    mode));
+	TRACE(("forkshell(%%%d, 0x%lx, %d) called\n", jp ? jp->jobno : 0,
+	    (long)n, mode));
+	if (mode == FORK_BG && (jp == NULL || jp->nprocs == 0))
+		waitslot();
 	INTOFF;
 	pid = fork();
 	if (pid == -1) {
@@ -550,10 +837,13 @@ forkshell(jp, n, mode)
 		TRACE(("Child shell %d\n", getpid()));
 		wasroot = rootshell;
 		rootshell = 0;
-		for (i = njobs, p = jobtab ; --i >= 0 ; p++)
-			if (p->used)
+		for (i = 0 ; i < njobs ; i++)
+			if ((p = jobtab[i])->used)
 				freejob(p);
 		closescript();
+		backnest = 0;
+		out1 = &output;
+		out2 = &errout;
 		INTON;
 		clear_traps();
 #if JOBS
@@ -600,6 +890,28 @@ forkshell(jp, n, mode)
 		}
 		return pid;
 	}
+	forkparent(jp, n, mode, pid);
+	INTON;
+	TRACE(("In parent shell:  child = %d\n", pid));
+	return pid;
+}
+
+
+/*
+ * The parent's half of forkshell:  put the child in its process group
+ * and record it in the job structure.
+ */
+
+STATIC void
+forkparent(jp, n, mode, pid)
+	struct job *jp;
+	union node *n;
+	int mode;
+	int pid;
+{
+	int pgrp;
+
+	filegen++;			/* the child may make commands */
 	if (rootshell && mode != FORK_NOJOB && mflag) {
 		if (jp == NULL || jp->nprocs == 0)
 			pgrp = pid;
@@ -609,6 +921,10 @@ forkshell(jp, n, mode)
 	}
 	if (mode == FORK_BG)
 		backgndpid = pid;		/* set $! */
+	if (jp && mode == FORK_BG && jp->nprocs == 0) {
+		jp->bg = 1;
+		nbgrun++;
+	}
 	if (jp) {
 		struct procstat *ps = &jp->ps[jp->nprocs++];
 		ps->pid = pid;
@@ -616,9 +932,120 @@ forkshell(jp, n, mode)
 		ps->cmd = nullstr;
 		if (iflag && rootshell && n)
 			ps->cmd = commandtext(n);
+		pidadd(pid, jp, jp->nprocs - 1);
+		nlive++;
+	}
+}
+
+
+
+/*
+ * Start a program without forking the shell.  Jp, n and mode are as for
+ * forkshell.  Infd and outfd, unless -1, become the standard input and
+ * output of the program before the redirections in redir are applied;
+ * file is the pathname to execute.  The program gets the process group,
+ * signal dispositions and standard input that it would have had if a
+ * forkshell child had exec'ed it.  Returns the pid, or -1 if the program
+ * could not be started this way, in which case the caller should fall
+ * back on forkshell, which also takes care of reporting any error.
+ *
+ * Interactive shells always fork, as do foreground jobs under job
+ * control, since the child has to get the terminal before it runs.
+ */
+
+int
+spawnshell(jp, n, mode, infd, outfd, redir, file, argv, envp)
+	struct job *jp;
+	union node *n;
+	int mode;
+	int infd, outfd;
+	union node *redir;
+	char *file;
+	char **argv, **envp;
+{
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	sigset_t mask, dfl, omask;
+	struct sigaction ign, saveint, savequit;
+	short spflags;
+	pid_t pid;
+	int bgign;
+	int e;
+
+	if (rootshell && (iflag || (mflag && mode == FORK_FG)))
+		return -1;
+	TRACE(("spawnshell(%%%d, 0x%lx, %d) called\n", jp ? jp->jobno : 0,
+	    (long)n, mode));
+	if (mode == FORK_BG && (jp == NULL || jp->nprocs == 0))
+		waitslot();
+	posix_spawn_file_actions_init(&fa);
+	posix_spawnattr_init(&attr);
+	sigemptyset(&mask);
+	sigemptyset(&dfl);
+	spflags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+	bgign = 0;
+	e = 0;
+	if (rootshell && mode != FORK_NOJOB && mflag) {
+		if (jp == NULL || jp->nprocs == 0)
+			posix_spawnattr_setpgroup(&attr, 0);
+		else
+			posix_spawnattr_setpgroup(&attr, jp->ps[0].pid);
+		spflags |= POSIX_SPAWN_SETPGROUP;
+		if (! trapignored(SIGTSTP))
+			sigaddset(&dfl, SIGTSTP);
+		if (! trapignored(SIGTTOU))
+			sigaddset(&dfl, SIGTTOU);
+	} else if (mode == FORK_BG) {
+		bgign = 1;
+		if ((jp == NULL || jp->nprocs == 0) && ! fd0_redirected_p ())
+			e = posix_spawn_file_actions_addopen(&fa, 0,
+			    "/dev/null", O_RDONLY, 0);
+	}
+	if (e == 0 && infd >= 0)
+		e = posix_spawn_file_actions_adddup2(&fa, infd, 0);
+	if (e == 0 && outfd >= 0)
+		e = posix_spawn_file_actions_adddup2(&fa, outfd, 1);
+	if (e != 0 || ! spawnredir(redir, &fa)) {
+		posix_spawn_file_actions_destroy(&fa);
+		posix_spawnattr_destroy(&attr);
+		return -1;
+	}
+	posix_spawnattr_setsigmask(&attr, &mask);
+	posix_spawnattr_setsigdefault(&attr, &dfl);
+	posix_spawnattr_setflags(&attr, spflags);
+	INTOFF;
+	if (bgign) {
+		/*
+		 * Posix_spawn can only reset signals to the default, so the
+		 * child has to inherit ignored SIGINT and SIGQUIT from us.
+		 * Keep them blocked meanwhile so that none is lost.
+		 */
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGINT);
+		sigaddset(&mask, SIGQUIT);
+		sigprocmask(SIG_BLOCK, &mask, &omask);
+		ign.sa_handler = SIG_IGN;
+		sigemptyset(&ign.sa_mask);
+		ign.sa_flags = 0;
+		sigaction(SIGINT, &ign, &saveint);
+		sigaction(SIGQUIT, &ign, &savequit);
+	}
+	e = posix_spawn(&pid, file, &fa, &attr, argv, envp);
+	if (bgign) {
+		sigaction(SIGINT, &saveint, (struct sigaction *)NULL);
+		sigaction(SIGQUIT, &savequit, (struct sigaction *)NULL);
+		sigprocmask(SIG_SETMASK, &omask, (sigset_t *)NULL);
 	}
+	posix_spawn_file_actions_destroy(&fa);
+	posix_spawnattr_destroy(&attr);
+	if (e != 0) {
+		TRACE(("Spawn of %s failed, errno=%d\n", file, e));
+		INTON;
+		return -1;
+	}
+	forkparent(jp, n, mode, pid);
 	INTON;
-	TRACE(("In parent shell:  child = %d\n", pid));
+	TRACE(("Spawned child %d\n", pid));
 	return pid;
 }
 
@@ -654,9 +1081,10 @@ waitforjob(jp)
 	int st;
 
 	INTOFF;
-	TRACE(("waitforjob(%%%d) called\n", jp - jobtab + 1));
+	TRACE(("waitforjob(%%%d) called\n", jp->jobno));
 	while (jp->state == 0) {
-		dowait(1, jp);
+		if (dowait(1, jp) < 0)
+			break;
 	}
 #if JOBS
 	if (jp->jobctl) {
@@ -664,7 +1092,7 @@ waitforjob(jp)
 			error("TIOCSPGRP failed, errno=%d\n", errno);
 	}
 	if (jp->state == JOBSTOPPED)
-		curjob = jp - jobtab + 1;
+		curjob = jp->jobno;
 #endif
 	status = jp->ps[jp->nprocs - 1].status;
 	/* convert to 8 bits */
@@ -698,9 +1126,10 @@ waitforjob_pipefail(jp)
 
 	worst = 0;
 	INTOFF;
-	TRACE(("waitforjob_pipefail(%%%d) called\n", jp - jobtab + 1));
+	TRACE(("waitforjob_pipefail(%%%d) called\n", jp->jobno));
 	while (jp->state == 0) {
-		dowait(1, jp);
+		if (dowait(1, jp) < 0)
+			break;
 	}
 #if JOBS
 	if (jp->jobctl) {
@@ -708,7 +1137,7 @@ waitforjob_pipefail(jp)
 			error("TIOCSPGRP failed, errno=%d\n", errno);
 	}
 	if (jp->state == JOBSTOPPED)
-		curjob = jp - jobtab + 1;
+		curjob = jp->jobno;
 #endif
 	for (i = 0; i < jp->nprocs; i++) {
 		status = jp->ps[i].status;
@@ -736,7 +1165,20 @@ waitforjob_pipefail(jp)
 
 
 /*
- * Wait for a process to terminate.
+ * Wait for any child process to stop or terminate, updating the job
+ * table.  Returns its pid, or -1 if there are no children.
+ */
+
+int
+waitchild() {
+	return dowait(1, (struct job *)NULL);
+}
+
+
+
+/*
+ * Wait for a process to terminate.  When blocking on behalf of a job,
+ * only the processes of that job are waited for.
  */
 
 STATIC int
@@ -745,50 +1187,61 @@ dowait(block, job)
 	struct job *job;
 {
 	int pid;
+	int wpid;
 	int status;
 	struct procstat *sp;
 	struct job *jp;
 	struct job *thisjob;
+	struct pident *pe;
 	int done;
 	int stopped;
 	int core;
 
 	TRACE(("dowait(%d) called\n", block));
+	wpid = -1;
+	if (block && job != NULL) {
+		for (sp = job->ps ; sp < job->ps + job->nprocs ; sp++)
+			if (sp->status == -1) {
+				wpid = sp->pid;
+				break;
+			}
+	}
 	do {
-		pid = waitproc(block, &status);
+		pid = waitproc(block, wpid, &status);
 		TRACE(("wait returns %d, status=%d\n", pid, status));
 	} while (pid == -1 && errno == EINTR);
 	if (pid <= 0)
 		return pid;
 	INTOFF;
 	thisjob = NULL;
-	for (jp = jobtab ; jp < jobtab + njobs ; jp++) {
-		if (jp->used) {
-			done = 1;
-			stopped = 1;
-			for (sp = jp->ps ; sp < jp->ps + jp->nprocs ; sp++) {
-				if (sp->pid == -1)
-					continue;
-				if (sp->pid == pid) {
-					TRACE(("Changin status of proc %d from 0x%x to 0x%x\n", pid, sp->status, status));
-					sp->status = status;
-					thisjob = jp;
-				}
-				if (sp->status == -1)
-					stopped = 0;
-				else if ((sp->status & 0377) == 0177)
-					done = 0;
-			}
-			if (stopped) {		/* stopped or done */
-				int state = done? JOBDONE : JOBSTOPPED;
-				if (jp->state != state) {
-					TRACE(("Job %d: changing state from %d to %d\n", jp - jobtab + 1, jp->state, state));
-					jp->state = state;
+	if ((pe = pidlookup(pid)) != NULL) {
+		jp = thisjob = pe->jp;
+		sp = &jp->ps[pe->procno];
+		TRACE(("Changin status of proc %d from 0x%x to 0x%x\n", pid, sp->status, status));
+		if (sp->status == -1)
+			nlive--;
+		sp->status = status;
+		done = 1;
+		stopped = 1;
+		for (sp = jp->ps ; sp < jp->ps + jp->nprocs ; sp++) {
+			if (sp->status == -1)
+				stopped = 0;
+			else if ((sp->status & 0377) == 0177)
+				done = 0;
+		}
+		if (stopped) {		/* stopped or done */
+			int state = done? JOBDONE : JOBSTOPPED;
+			if (jp->state != state) {
+				TRACE(("Job %d: changing state from %d to %d\n", jp->jobno, jp->state, state));
+				if (jp->bg && jp->state == 0)
+					nbgrun--;
+				jp->state = state;
+				if (done && jp->bg)
+					donelink(jp);
 #if JOBS
-					if (done && curjob == jp - jobtab + 1)
-						curjob = 0;		/* no current job */
+				if (done && curjob == jp->jobno)
+					curjob = 0;		/* no current job */
 #endif
-				}
 			}
 		}
 	}
@@ -805,7 +1258,7 @@ dowait(block, job)
 				outfmt(out2, "%d: ", pid);
 #if JOBS
 			if (status == SIGTSTP && rootshell && iflag)
-				outfmt(out2, "%%%d ", job - jobtab + 1);
+				outfmt(out2, "%%%d ", job->jobno);
 #endif
 			if (status < NSIG && strsignal(status))
 				out2str(strsignal(status));
@@ -820,8 +1273,10 @@ dowait(block, job)
 		}
 	} else {
 		TRACE(("Not printing status, rootshell=%d, job=0x%x\n", rootshell, job));
-		if (thisjob)
+		if (thisjob && ! thisjob->changed) {
 			thisjob->changed = 1;
+			nchanged++;
+		}
 	}
 	return pid;
 }
@@ -831,7 +1286,7 @@ dowait(block, job)
 /*
  * Do a wait system call.  If job control is compiled in, we accept
  * stopped processes.  If block is zero, we return a value of zero
- * rather than blocking.
+ * rather than blocking.  Pid is the process to wait for, or -1 for any.
  *
  * System V doesn't have a non-blocking wait system call.  It does
  * have a SIGCLD signal that is sent to a process when one of it's
@@ -867,8 +1322,9 @@ STATIC int onsigchild() {
 
 
 STATIC int
-waitproc(block, status)
+waitproc(block, pid, status)
 	int block;
+	int pid;
 	int *status;
 {
 	int flags;
@@ -880,7 +1336,7 @@ waitproc(block, status)
 #endif
 	if (block == 0)
 		flags |= WNOHANG;
-	return waitpid(-1, status, flags);
+	return waitpid(pid, status, flags);
 }
 
 /*
@@ -895,7 +1351,8 @@ stoppedjobs()
 
 	if (job_warning)
 		return (0);
-	for (jobno = 1, jp = jobtab; jobno <= njobs; jobno++, jp++) {
+	for (jobno = 1; jobno <= njobs; jobno++) {
+		jp = jobtab[jobno - 1];
 		if (jp->used == 0)
 			continue;
 		if (jp->state == JOBSTOPPED) {
@@ -996,9 +1453,14 @@ until:
 		break;
 	case NFOR:
 		cmdputs("for ");
+		if (n->nfor.par)
+			cmdputs("-P ... ");
 		cmdputs(n->nfor.var);
 		cmdputs(" in ...");
 		break;
+	case NFORARITH:
+		cmdputs("for ((...)) ...");
+		break;
 	case NCASE:
 		cmdputs("case ");
 		cmdputs(n->ncase.expr->narg.text);
@@ -1022,6 +1484,16 @@ until:
 	case NARG:
 		cmdputs(n->narg.text);
 		break;
+	case NARRAY:
+		cmdputs(n->narray.text);
+		cmdputs("(");
+		for (np = n->narray.elems ; np ; np = np->narg.next) {
+			cmdtxt(np);
+			if (np->narg.next)
+				cmdputs(" ");
+		}
+		cmdputs(")");
+		break;
 	case NTO:
 		p = ">";  i = 1;  goto redir;
 	case NAPPEND:
@@ -1066,6 +1538,7 @@ cmdputs(s)
 	register char *p, *q;
 	register char c;
 	int subtype = 0;
+	int arraytype = 0;
 
 	if (cmdnleft <= 0)
 		return;
@@ -1079,9 +1552,18 @@ cmdputs(s)
 			if (--cmdnleft > 0)
 				*q++ = '{';
 			subtype = *p++;
+		} else if (c == '=' && (subtype & VSARRAY)) {
+			*q++ = '[';
+			arraytype = subtype;
+			subtype = 0;
 		} else if (c == '=' && subtype != 0) {
 			*q++ = "}-+?="[(subtype & VSTYPE) - VSNORMAL];
 			subtype = 0;
+		} else if (c == CTLENDVAR && arraytype != 0) {
+			*q++ = ']';
+			if ((arraytype & VSTYPE) <= VSASSIGN && --cmdnleft > 0)
+				*q++ = "}-+?="[(arraytype & VSTYPE) - VSNORMAL];
+			arraytype = 0;
 		} else if (c == CTLENDVAR) {
 			*q++ = '}';
 		} else if ((c == CTLBACKQ) | (c == CTLBACKQ+CTLQUOTE))
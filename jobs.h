@@ -50,7 +50,7 @@
  */
 
 struct procstat {
-	short pid;		/* process id */
+	int pid;		/* process id */
 	short status;		/* status flags (defined above) */
 	char *cmd;		/* text of command being run */
 };
@@ -61,20 +61,28 @@ struct procstat {
 #define JOBDONE 2		/* all procs are completed */
 
 
+#define NPSINLINE 4		/* pipelines this long need no extra malloc */
+
 struct job {
-	struct procstat ps0;	/* status of process */
-	struct procstat *ps;	/* status or processes when more than one */
+	struct procstat ps0[NPSINLINE];	/* status of processes */
+	struct procstat *ps;	/* ps0, or malloc'ed for longer pipelines */
 	short nprocs;		/* number of processes */
-	short pgrp;		/* process group of this job */
+	int pgrp;		/* process group of this job */
+	int jobno;		/* job number, index in jobtab + 1 */
+	int nextfree;		/* next unused slot if not in use */
+	struct job *donenext;	/* list of completed background jobs */
+	struct job *doneprev;
 	char state;		/* true if job is finished */
 	char used;		/* true if this entry is in used */
 	char changed;		/* true if status has changed */
+	char bg;		/* running in the background */
+	char ondone;		/* on the list of completed jobs */
 #if JOBS
 	char jobctl;		/* job running under job control */
 #endif
 };
 
-extern short backgndpid;	/* pid of last background process */
+extern int backgndpid;	/* pid of last background process */
 extern int job_warning;		/* user was warned about stopped jobs */
 
 void setjobctl __P((int));
@@ -83,11 +91,15 @@ int bgcmd __P((int, char **));
 int jobscmd __P((int, char **));
 void showjobs __P((int));
 int waitcmd __P((int, char **));
+int jobslotscmd __P((int, char **));
 int jobidcmd __P((int, char **));
 struct job *makejob __P((union node *, int));
 int forkshell __P((struct job *, union node *, int));
+int spawnshell __P((struct job *, union node *, int, int, int, union node *,
+    char *, char **, char **));
 int waitforjob __P((struct job *));
 int waitforjob_pipefail __P((struct job *));
+int waitchild __P((void));
 int stoppedjobs __P((void));
 char *commandtext __P((union node *));
 
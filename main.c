@@ -174,7 +174,7 @@ state2:
 state3:
 	state = 4;
 	if (minusc) {
-			evalstring(minusc);
+			evalstring(minusc, sflag ? 0 : EV_EXIT);
 	}
 	if (sflag || minusc == NULL) {
 state4:	/* XXX ??? - why isn't this before the "if" statement */
@@ -229,7 +229,7 @@ cmdloop(top)
 		} else if (n != NULL && nflag == 0) {
 			job_warning = (job_warning == 2) ? 1 : 0;
 			numeof = 0;
-			evaltree(n, 0);
+			evaltree(n, top && ! iflag && parseatend() ? EV_EXIT : 0);
 		}
 		popstackmark(&smark);
 	}
@@ -42,6 +42,9 @@ static char sccsid[] = "@(#)miscbltin.c	8.4 (Berkeley) 5/4/95";
  * Miscelaneous builtins.
  */
 
+#ifdef LINUX
+#define _GNU_SOURCE		/* for tee */
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -49,6 +52,8 @@ static char sccsid[] = "@(#)miscbltin.c	8.4 (Berkeley) 5/4/95";
 #include <sys/wait.h>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <ctype.h>
 
 #include "shell.h"
@@ -73,17 +78,53 @@ extern char **argptr;		/* argument list for builtin command */
  * The read builtin.  The -e option causes backslashes to escape the
  * following character.
  *
- * This uses unbuffered input, which may be avoidable in some cases.
+ * The shell must not read past the end of the line, since the rest of
+ * the input belongs to whatever command runs next.  A regular file is
+ * read in chunks and the offset is moved back to just after the line.
+ * A pipe cannot be moved back, so on Linux the data in it is copied
+ * with tee(2) first and then exactly one line is taken out of it.
+ * Anything else, such as a terminal, is read a byte at a time.
  */
 
+#define RD_BYTE 0		/* read a byte at a time */
+#define RD_FILE 1		/* read a chunk, then seek back */
+#define RD_PIPE 2		/* peek with tee, then read one line */
+
+#define READBUFSIZE 8192
+#define READMINCHUNK 128
+
+STATIC char readbuf[READBUFSIZE];
+STATIC char *readnext;		/* next character in readbuf */
+STATIC char *readlast;		/* end of the characters in readbuf */
+STATIC int readkind;		/* how fd 0 is read, RD_BYTE etc. */
+STATIC int readfills;		/* number of refills for this line */
+STATIC int readchunk = READMINCHUNK;	/* first read size for a file */
+#ifdef LINUX
+STATIC int peekpipe[2] = {-1, -1};	/* private pipe for tee */
+STATIC pid_t peekpid;		/* process which created peekpipe */
+#endif
+
+STATIC void readinit __P((void));
+STATIC int readfill __P((void));
+STATIC void readdone __P((void));
+#ifdef LINUX
+STATIC int peekopen __P((void));
+STATIC void peekclose __P((void));
+STATIC int peekline __P((char *, int, int, int));
+#endif
+
+#define readchar()	(readnext < readlast ? *readnext++ & 0377 : readfill())
+
+
 int
 readcmd(argc, argv)
 	int argc;
 	char **argv; 
 {
 	char **ap;
+	char **vp;
 	int backslash;
-	char c;
+	int c;
 	int eflag;
 	char *prompt;
 	char *ifs;
@@ -111,9 +152,10 @@ readcmd(argc, argv)
 	status = 0;
 	startword = 1;
 	backslash = 0;
+	readinit();
 	STARTSTACKSTR(p);
 	for (;;) {
-		if (read(0, &c, 1) != 1) {
+		if ((c = readchar()) < 0) {
 			status = 1;
 			break;
 		}
@@ -135,30 +177,308 @@ readcmd(argc, argv)
 			continue;
 		}
 		startword = 0;
-		if (backslash && c == '\\') {
-			if (read(0, &c, 1) != 1) {
-				status = 1;
-				break;
-			}
-			STPUTC(c, p);
-		} else if (ap[1] != NULL && strchr(ifs, c) != NULL) {
-			STACKSTRNUL(p);
-			setvar(*ap, stackblock(), 0);
+		if (ap[1] != NULL && strchr(ifs, c) != NULL) {
+			STPUTC('\0', p);
 			ap++;
 			startword = 1;
-			STARTSTACKSTR(p);
 		} else {
 			STPUTC(c, p);
 		}
 	}
-	STACKSTRNUL(p);
-	setvar(*ap, stackblock(), 0);
-	while (*++ap != NULL)
-		setvar(*ap, nullstr, 0);
+	readdone();
+	/*
+	 * The variables are set only now, so that an error from setvar
+	 * cannot leave the input offset past the line.
+	 */
+	STPUTC('\0', p);
+	p = grabstackstr(p);
+	for (vp = argptr ; vp <= ap ; vp++) {
+		setvar(*vp, p, 0);
+		p += strlen(p) + 1;
+	}
+	while (*vp != NULL)
+		setvar(*vp++, nullstr, 0);
 	return status;
 }
 
 
+STATIC void
+readinit() {
+	struct stat st;
+
+	readnext = readlast = readbuf;
+	readfills = 0;
+	readkind = RD_BYTE;
+	if (fstat(0, &st) < 0)
+		return;
+	if (S_ISREG(st.st_mode))
+		readkind = RD_FILE;
+#ifdef LINUX
+	else if (S_ISFIFO(st.st_mode) && peekopen())
+		readkind = RD_PIPE;
+#endif
+}
+
+
+/*
+ * Refill readbuf and return its first character, or -1 on end of
+ * file or error.
+ */
+
+STATIC int
+readfill() {
+	int n;
+
+	switch (readkind) {
+	case RD_FILE:
+		if (readfills++ > 0 && readchunk < READBUFSIZE)
+			readchunk <<= 1;
+		n = read(0, readbuf, readchunk);
+		break;
+#ifdef LINUX
+	case RD_PIPE:
+		n = peekline(readbuf, READBUFSIZE, '\n', 1);
+		break;
+#endif
+	default:
+		n = read(0, readbuf, 1);
+		break;
+	}
+	if (n <= 0) {
+		readnext = readlast = readbuf;
+		return -1;
+	}
+	readnext = readbuf + 1;
+	readlast = readbuf + n;
+	return readbuf[0] & 0377;
+}
+
+
+/*
+ * Give back what was read beyond the line, and size the next chunk
+ * by the length of this line.
+ */
+
+STATIC void
+readdone() {
+	if (readkind != RD_FILE)
+		return;
+	if (readnext < readlast)
+		lseek(0, (off_t)(readnext - readlast), SEEK_CUR);
+	if (readfills == 1 && (readnext - readbuf) * 4 < readchunk
+	 && readchunk > READMINCHUNK)
+		readchunk >>= 1;
+	readnext = readlast = readbuf;
+}
+
+
+#ifdef LINUX
+STATIC int
+peekopen() {
+	int pip[2];
+	int i;
+
+	if (peekpipe[0] >= 0 && peekpid == getpid())
+		return 1;
+	peekclose();		/* inherited from our parent */
+	if (pipe(pip) < 0)
+		return 0;
+	for (i = 0 ; i < 2 ; i++) {
+		peekpipe[i] = fcntl(pip[i], F_DUPFD_CLOEXEC, 10);
+		close(pip[i]);
+	}
+	if (peekpipe[0] < 0 || peekpipe[1] < 0) {
+		peekclose();
+		return 0;
+	}
+	peekpid = getpid();
+	return 1;
+}
+
+
+STATIC void
+peekclose() {
+	int i;
+
+	for (i = 0 ; i < 2 ; i++) {
+		if (peekpipe[i] >= 0)
+			close(peekpipe[i]);
+		peekpipe[i] = -1;
+	}
+}
+
+
+/*
+ * Copy what is waiting in the pipe on fd 0 into buf without consuming
+ * it, then read from fd 0 only up to and including the n'th delimiter.
+ */
+
+STATIC int
+peekline(buf, len, delim, n)
+	char *buf;
+	int len;
+	int delim;
+	int n;
+{
+	int nr, m, i;
+	char *p, *q;
+
+	nr = tee(0, peekpipe[1], len, 0);
+	if (nr <= 0) {
+		if (nr < 0 && errno == EINVAL) {
+			readkind = RD_BYTE;
+			return read(0, buf, 1);
+		}
+		return nr;
+	}
+	for (i = 0 ; i < nr ; i += m) {
+		if ((m = read(peekpipe[0], buf + i, nr - i)) <= 0) {
+			peekclose();
+			readkind = RD_BYTE;
+			return read(0, buf, 1);
+		}
+	}
+	for (p = buf ; n > 0 && (q = memchr(p, delim, buf + nr - p)) != NULL ; n--)
+		p = q + 1;
+	if (n == 0)
+		nr = p - buf;
+	return read(0, buf, nr);
+}
+#endif
+
+/*
+ * The mapfile builtin.  Records ending in the delimiter are read from
+ * the standard input into an indexed array, starting at element 0.
+ * The input is read in large blocks where that does not take more than
+ * is needed; with -n, the rest is left to the next command as for read.
+ */
+
+#define MAPBUFSIZE 65536
+
+STATIC int mapfill __P((char *, int, int, int));
+STATIC void mapstore __P((char *, int, char *, char *));
+
+int
+mapfilecmd(argc, argv)
+	int argc;
+	char **argv;
+{
+	char *name;
+	char *buf, *nbuf, *p, *q, *end;
+	int delim;
+	int count, skip, strip;
+	int size, len, index, n;
+	int i;
+
+	delim = '\n';
+	count = skip = strip = 0;
+	while ((i = nextopt("d:n:s:t")) != '\0') {
+		switch (i) {
+		case 'd':
+			delim = optarg[0] & 0377;
+			break;
+		case 'n':
+			count = number(optarg);
+			break;
+		case 's':
+			skip = number(optarg);
+			break;
+		case 't':
+			strip = 1;
+			break;
+		}
+	}
+	if ((name = *argptr) == NULL || argptr[1] != NULL)
+		error("usage: mapfile [-t] [-d delim] [-n count] [-s skip] name");
+	setarray(name, (struct strlist *)NULL, 0);
+	readinit();
+	size = MAPBUFSIZE;
+	buf = stalloc(size + 1);
+	len = 0;
+	index = 0;
+	for (;;) {
+		p = buf;
+		end = buf + len;
+		while ((count == 0 || index < count)
+		 && (q = memchr(p, delim, end - p)) != NULL) {
+			if (skip > 0)
+				skip--;
+			else
+				mapstore(name, index++, p, q + 1 - strip);
+			p = q + 1;
+		}
+		len = end - p;
+		if (count > 0 && index >= count)
+			break;
+		if (p != buf)
+			memmove(buf, p, len);
+		if (len == size) {		/* a long record */
+			nbuf = stalloc(2 * size + 1);
+			memcpy(nbuf, buf, len);
+			buf = nbuf;
+			size *= 2;
+		}
+		n = mapfill(buf + len, size - len, delim,
+		    count > 0 ? skip + count - index : 0);
+		if (n <= 0) {
+			if (len > 0 && skip == 0)	/* no final delimiter */
+				mapstore(name, index++, buf, buf + len);
+			len = 0;
+			break;
+		}
+		len += n;
+	}
+	if (readkind == RD_FILE && len > 0)
+		lseek(0, -(off_t)len, SEEK_CUR);
+	return 0;
+}
+
+
+/*
+ * Read more input into buf.  If n is nonzero, only n more records
+ * ending in delim are wanted, so a pipe or terminal must not be read
+ * beyond them.
+ */
+
+STATIC int
+mapfill(buf, len, delim, n)
+	char *buf;
+	int len;
+	int delim;
+	int n;
+{
+	if (n > 0) {
+#ifdef LINUX
+		if (readkind == RD_PIPE)
+			return peekline(buf, len, delim, n);
+#endif
+		if (readkind == RD_BYTE)
+			return read(0, buf, 1);
+	}
+	return read(0, buf, len);
+}
+
+
+/*
+ * Store the characters from p up to end as element index of the array.
+ */
+
+STATIC void
+mapstore(name, index, p, end)
+	char *name;
+	int index;
+	char *p;
+	char *end;
+{
+	int c;
+
+	c = *end;
+	*end = '\0';
+	setelem(name, index, p);
+	*end = c;
+}
+
+
 
 int
 umaskcmd(argc, argv)
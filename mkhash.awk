@@ -0,0 +1,65 @@
+# Generate a perfect hash for a fixed set of names, for mkbuiltins and
+# mktokens.  Each input line is a name and the number to map it to.
+# The hash is
+#
+#	(s[0] * A + s[len - 1] * B + s[1] + len) & (SIZE - 1)
+#
+# with SIZE at least four times the number of names and A and B found
+# by trying until no two names collide.  With out=h the macros NAMEHASH
+# and NAMEHASHSIZE are printed (NAME is the value of the variable mac);
+# with out=c the table tab[], holding the number for each hash value or
+# -1, is printed; with neither both are.
+
+BEGIN {
+	for (i = 1 ; i < 128 ; i++)
+		ord[sprintf("%c", i)] = i
+}
+
+{
+	n++
+	name[n] = $1
+	val[n] = $2
+}
+
+function hash(s) {
+	return (ord[substr(s, 1, 1)] * a + ord[substr(s, length(s), 1)] * b \
+	    + ord[substr(s, 2, 1)] + length(s)) % size
+}
+
+END {
+	for (size = 1 ; size < 4 * n ; size *= 2);
+	for (a = 1 ; a < 256 ; a++) {
+		for (b = 0 ; b < 256 ; b++) {
+			for (i = 0 ; i < size ; i++)
+				slot[i] = -1
+			for (i = 1 ; i <= n ; i++) {
+				h = hash(name[i])
+				if (slot[h] >= 0)
+					break
+				slot[h] = val[i]
+			}
+			if (i > n)
+				break
+		}
+		if (b < 256)
+			break
+	}
+	if (a == 256) {
+		print "mkhash: no perfect hash found" > "/dev/stderr"
+		exit 2
+	}
+	if (out != "c") {
+		printf "#define %sHASHSIZE %d\n", mac, size
+		printf "#define %sHASH(s, len) \\\n", mac
+		printf "\t(((unsigned char)(s)[0] * %d + (unsigned char)(s)[(len) - 1] * %d \\\n", a, b
+		printf "\t    + (unsigned char)(s)[1] + (len)) & (%sHASHSIZE - 1))\n", mac
+	}
+	if (out != "h") {
+		if (out != "c")
+			print ""
+		printf "const short %s[] = {", tab
+		for (i = 0 ; i < size ; i++)
+			printf "%s%d,", i % 16 ? " " : "\n\t", slot[i]
+		print "\n};"
+	}
+}
@@ -62,8 +62,9 @@ struct shparam {
 #define	bflag optlist[13].val
 #define	uflag optlist[14].val
 #define	pflag optlist[15].val
+#define	Hflag optlist[16].val
 
-#define NOPTS	16
+#define NOPTS	17
 
 struct optent {
 	const char *name;
@@ -89,6 +90,7 @@ struct optent optlist[NOPTS] = {
 	{ "notify",	'b',	0 },
 	{ "nounset",	'u',	0 },
 	{ "pipefail",	'p',	0 },
+	{ "hashdirs",	'H',	0 },
 };
 #else
 extern struct optent optlist[NOPTS];
@@ -70,6 +70,7 @@ extern char *curdir;
  */
 
 #define EOFMARKLEN 79
+#define MAXSUBNEST 16		/* nesting of ${name[subscript]} */
 
 /* values returned by readtoken */
 #include "token.def"
@@ -85,6 +86,20 @@ struct heredoc {
 
 
 
+/*
+ * A subscript ${name[...]} being read by readtoken1.
+ */
+
+struct subscr {
+	int typeloc;		/* where the variable type goes */
+	int subtype;		/* subtype seen before the '[' */
+	int depth;		/* levels of brackets */
+	int varnest;		/* varnest inside the subscript */
+	char const *syntax;	/* syntax at the '[' */
+};
+
+
+
 struct heredoc *heredoclist;	/* list of here documents to read */
 int parsebackquote;		/* nonzero if we are inside backquotes */
 int doprompt;			/* if set, prompt the user */
@@ -112,6 +127,10 @@ STATIC union node *andor __P((void));
 STATIC union node *pipeline __P((void));
 STATIC union node *command __P((void));
 STATIC union node *simplecmd __P((union node **, union node *));
+STATIC int arraystart __P((union node *, union node *));
+STATIC char *arithtext __P((void));
+STATIC union node *makearith __P((char *));
+STATIC union node *forarith __P((void));
 STATIC union node *parsedbracket __P((void));
 STATIC union node *parsedbor __P((void));
 STATIC union node *parsedband __P((void));
@@ -158,6 +177,19 @@ parsecmd(interact)
 }
 
 
+/*
+ * Return true if the command just returned by parsecmd is the last one
+ * in the input.
+ */
+
+int
+parseatend() {
+	if (tokpushback)
+		return lasttoken == TEOF;
+	return inputatend();
+}
+
+
 STATIC union node *
 list(nlflag) 
 	int nlflag;
@@ -303,6 +335,7 @@ command() {
 	union node *ap, **app;
 	union node *cp, **cpp;
 	union node *redir, **rpp;
+	union node **bodyp;
 	int t;
 
 	checkkwd = 2;
@@ -362,10 +395,30 @@ TRACE(("expecting DO got %s %s\n", tokname[got], got == TWORD ? wordtext : ""));
 		break;
 	}
 	case TFOR:
-		if (readtoken() != TWORD || quoteflag || ! goodname(wordtext))
-			synerror("Bad for loop variable");
+		if ((t = readtoken()) == TLP) {
+			n1 = forarith();
+			bodyp = &n1->nforarith.body;
+			if ((t = readtoken()) != TNL && t != TSEMI)
+				tokpushback++;
+			goto forbody;
+		}
 		n1 = (union node *)stalloc(sizeof (struct nfor));
 		n1->type = NFOR;
+		n1->nfor.par = NULL;
+		bodyp = &n1->nfor.body;
+		if (t == TWORD && ! quoteflag && equal(wordtext, "-P")) {
+			if (readtoken() != TWORD)
+				synexpect(TWORD);
+			n2 = (union node *)stalloc(sizeof (struct narg));
+			n2->type = NARG;
+			n2->narg.text = wordtext;
+			n2->narg.backquote = backquotelist;
+			n2->narg.next = NULL;
+			n1->nfor.par = n2;
+			t = readtoken();
+		}
+		if (t != TWORD || quoteflag || ! goodname(wordtext))
+			synerror("Bad for loop variable");
 		n1->nfor.var = wordtext;
 		if (readtoken() == TWORD && ! quoteflag && equal(wordtext, "in")) {
 			app = &ap;
@@ -399,6 +452,7 @@ TRACE(("expecting DO got %s %s\n", tokname[got], got == TWORD ? wordtext : ""));
 			if (lasttoken != TNL && lasttoken != TSEMI)
 				tokpushback++;
 		}
+forbody:
 		checkkwd = 2;
 		if ((t = readtoken()) == TDO)
 			t = TDONE;
@@ -406,7 +460,7 @@ TRACE(("expecting DO got %s %s\n", tokname[got], got == TWORD ? wordtext : ""));
 			t = TEND;
 		else
 			synexpect(-1);
-		n1->nfor.body = list(0);
+		*bodyp = list(0);
 		if (readtoken() != t)
 			synexpect(t);
 		checkkwd = 1;
@@ -460,35 +514,7 @@ TRACE(("expecting DO got %s %s\n", tokname[got], got == TWORD ? wordtext : ""));
 	case TLP: {
 		int nc2 = pgetc();
 		if (nc2 == '(') {
-			char abuf[4096];
-			int alen = 0;
-			int depth = 1;
-			int ac;
-			while ((ac = pgetc()) != PEOF) {
-				if (ac == '(') {
-					depth++;
-					if (alen < 4095) abuf[alen++] = ac;
-				} else if (ac == ')') {
-					depth--;
-					if (depth == 0) {
-						int nc3 = pgetc();
-						if (nc3 != ')') {
-							pungetc();
-							if (alen < 4095) abuf[alen++] = ')';
-						} else {
-							break;
-						}
-					} else {
-						if (alen < 4095) abuf[alen++] = ac;
-					}
-				} else {
-					if (alen < 4095) abuf[alen++] = ac;
-				}
-			}
-			abuf[alen] = '\0';
-			n1 = (union node *)stalloc(sizeof (struct narith));
-			n1->type = NARITH;
-			n1->narith.text = savestr(abuf);
+			n1 = makearith(arithtext());
 			checkkwd = 1;
 		} else {
 			pungetc();
@@ -571,6 +597,92 @@ TRACE(("expecting DO got %s %s\n", tokname[got], got == TWORD ? wordtext : ""));
 }
 
 
+/*
+ * Read the text of an arithmetic command, after the "((", up to the
+ * matching "))".
+ */
+
+STATIC char *
+arithtext() {
+	char *out;
+	int depth;
+	int c;
+
+	STARTSTACKSTR(out);
+	depth = 0;
+	for (;;) {
+		if ((c = pgetc()) == PEOF)
+			synerror("Missing '))'");
+		if (c == '(')
+			depth++;
+		else if (c == ')' && depth > 0)
+			depth--;
+		else if (c == ')') {
+			if (pgetc() == ')')
+				break;
+			pungetc();
+		}
+		STPUTC(c, out);
+	}
+	STPUTC('\0', out);
+	return grabstackstr(out);
+}
+
+
+STATIC union node *
+makearith(text)
+	char *text;
+	{
+	union node *n;
+
+	n = (union node *)stalloc(sizeof (struct narith));
+	n->type = NARITH;
+	n->narith.text = text;
+	n->narith.slot = 0;
+	n->narith.serial = 0;
+	return n;
+}
+
+
+/*
+ * Parse the "((init; cond; step))" of an arithmetic for loop, the "("
+ * having been read.  An empty expression gives a NULL node.
+ */
+
+STATIC union node *
+forarith() {
+	union node *n;
+	union node *part[3];
+	char *p, *q;
+	int i;
+
+	if (pgetc() != '(')
+		synerror("Bad for loop variable");
+	p = arithtext();
+	for (i = 0 ; i < 3 ; i++) {
+		q = strchr(p, ';');
+		if ((q == NULL) != (i == 2))
+			synerror("Bad arithmetic for loop");
+		if (q)
+			*q = '\0';
+		part[i] = NULL;
+		for (q = p ; *q ; q++) {
+			if (*q != ' ' && *q != '\t' && *q != '\n') {
+				part[i] = makearith(p);
+				break;
+			}
+		}
+		p += strlen(p) + 1;
+	}
+	n = (union node *)stalloc(sizeof (struct nforarith));
+	n->type = NFORARITH;
+	n->nforarith.init = part[0];
+	n->nforarith.cond = part[1];
+	n->nforarith.step = part[2];
+	return n;
+}
+
+
 
 STATIC int
 readregexword() {
@@ -899,7 +1011,7 @@ STATIC union node *
 simplecmd(rpp, redir) 
 	union node **rpp, *redir;
 	{
-	union node *args, **app;
+	union node *args, **app, **wapp, **epp;
 	union node **orig_rpp = rpp;
 	union node *n;
 
@@ -923,8 +1035,28 @@ simplecmd(rpp, redir)
 			n->type = NARG;
 			n->narg.text = wordtext;
 			n->narg.backquote = backquotelist;
+			wapp = app;
 			*app = n;
 			app = &n->narg.next;
+		} else if (lasttoken == TLP && app != &args
+			&& app == &n->narg.next && arraystart(args, n)) {
+			/* name=(word...) */
+			n = (union node *)stalloc(sizeof (struct narray));
+			n->type = NARRAY;
+			n->narray.text = (*wapp)->narg.text;
+			n->narray.backquote = NULL;
+			*wapp = n;
+			app = &n->narray.next;
+			epp = &n->narray.elems;
+			while (readtoken() != TRP) {
+				if (lasttoken == TNL)
+					continue;
+				if (lasttoken != TWORD)
+					synexpect(TRP);
+				*epp = makename();
+				epp = &(*epp)->narg.next;
+			}
+			*epp = NULL;
 		} else if (lasttoken == TREDIR) {
 			*rpp = n = redirnode;
 			rpp = &n->nfile.next;
@@ -956,6 +1088,37 @@ simplecmd(rpp, redir)
 	return n;
 }
 
+/*
+ * Called when a "(" follows the word n.  Return true if n is name= or
+ * name+= and either the words up to n are assignments or the command
+ * is declare, typeset or local, so that the words in parentheses are
+ * the elements of an array.
+ */
+
+STATIC int
+arraystart(args, n)
+	union node *args, *n;
+	{
+	char *p;
+
+	p = args->narg.text;
+	if (args->type != NARG || (! equal(p, "declare")
+	 && ! equal(p, "typeset") && ! equal(p, "local"))) {
+		for (; args != n ; args = args->narg.next)
+			if (args->type != NARRAY && ! assignword(args->narg.text))
+				return 0;
+	}
+	p = n->narg.text;
+	if (! is_name(*p))
+		return 0;
+	do
+		p++;
+	while (is_in_name(*p));
+	if (*p == '+')
+		p++;
+	return p[0] == '=' && p[1] == '\0';
+}
+
 STATIC union node *
 makename() {
 	union node *n;
@@ -1095,15 +1258,15 @@ readtoken() {
 		 */
 		if (t == TWORD && !quoteflag) 
 		{
-			register char * const *pp;
-
-			for (pp = (char **)parsekwd; *pp; pp++) {
-				if (**pp == *wordtext && equal(*pp, wordtext)) 
-				{
-					lasttoken = t = pp - parsekwd + KWDOFFSET;
-					TRACE(("keyword %s recognized\n", tokname[t]));
-					goto out;
-				}
+			int len, i;
+
+			/* kwdhash is a perfect hash made by mktokens */
+			if ((len = strlen(wordtext)) != 0
+			 && (i = kwdhash[KWDHASH(wordtext, len)]) >= 0
+			 && equal(parsekwd[i], wordtext)) {
+				lasttoken = t = i + KWDOFFSET;
+				TRACE(("keyword %s recognized\n", tokname[t]));
+				goto out;
 			}
 			if ((ap = lookupalias(wordtext, 1)) != NULL) {
 				pushstring(ap->val, strlen(ap->val), ap);
@@ -1252,6 +1415,9 @@ readtoken1(firstc, syntax, eofmark, striptabs)
 	int varnest;	/* levels of variables expansion */
 	int arinest;	/* levels of arithmetic expansion */
 	int parenlevel;	/* levels of parens in arithmetic */
+	int subnest;	/* levels of subscripts */
+	struct subscr subs[MAXSUBNEST];
+	struct subscr *sp;
 	int oldstyle;
 	int psdir;
 	char const *prevsyntax;	/* syntax before arithmetic */
@@ -1263,6 +1429,7 @@ readtoken1(firstc, syntax, eofmark, striptabs)
 	(void) &varnest;
 	(void) &arinest;
 	(void) &parenlevel;
+	(void) &subnest;
 	(void) &oldstyle;
 	(void) &prevsyntax;
 	(void) &syntax;
@@ -1277,6 +1444,7 @@ readtoken1(firstc, syntax, eofmark, striptabs)
 	varnest = 0;
 	arinest = 0;
 	parenlevel = 0;
+	subnest = 0;
 
 	STARTSTACKSTR(out);
 	loop: {	/* for each line, until end of word */
@@ -1306,6 +1474,14 @@ readtoken1(firstc, syntax, eofmark, striptabs)
 				c = pgetc();
 				goto loop;		/* continue outer loop */
 			case CWORD:
+				if (subnest > 0
+				 && varnest == (sp = &subs[subnest - 1])->varnest
+				 && syntax == sp->syntax) {
+					if (c == '[')
+						sp->depth++;
+					else if (c == ']' && --sp->depth == 0)
+						goto endsub;
+				}
 				if (syntax == BASESYNTAX &&
 				    (c == '?' || c == '*' || c == '+' ||
 				     c == '@' || c == '!')) {
@@ -1391,7 +1567,8 @@ readtoken1(firstc, syntax, eofmark, striptabs)
 				PARSESUB();		/* parse substitution */
 				break;
 			case CENDVAR:	/* '}' */
-				if (varnest > 0) {
+				if (varnest > 0 && (subnest == 0
+				 || varnest > subs[subnest - 1].varnest)) {
 					varnest--;
 					USTPUTC(CTLENDVAR, out);
 				} else {
@@ -1454,6 +1631,10 @@ endword:
 		synerror("Missing '))'");
 	if (syntax != BASESYNTAX && ! parsebackquote && eofmark == NULL)
 		synerror("Unterminated quoted string");
+	if (subnest != 0) {
+		startlinno = plinno;
+		synerror("Missing ']'");
+	}
 	if (varnest != 0) {
 		startlinno = plinno;
 		synerror("Missing '}'");
@@ -1690,6 +1871,15 @@ ansi_done:;
 				else
 					subtype = VSLENGTH;
 			}
+			else if (c == '!') {
+				if (is_name(c = pgetc())) {
+					subtype = VSKEYS;
+				} else {
+					pungetc();
+					c = '!';
+					subtype = 0;
+				}
+			}
 			else
 				subtype = 0;
 		}
@@ -1706,10 +1896,37 @@ badsub:				synerror("Bad substitution");
 		}
 		STPUTC('=', out);
 		flags = 0;
+		if (subtype == VSKEYS && c != '[')
+			goto badsub;
+		if (c == '[' && subtype != VSNORMAL
+		 && is_name(*(stackblock() + typeloc + 1))) {
+			/*
+			 * The subscript is read by the main loop, like the
+			 * word of ${name-word}, which comes back to endsub
+			 * when it reads the matching ']'.
+			 */
+			if (subnest >= MAXSUBNEST)
+				synerror("Subscripts nested too deeply");
+			sp = &subs[subnest++];
+			sp->typeloc = typeloc;
+			sp->subtype = subtype;
+			sp->depth = 1;
+			sp->varnest = ++varnest;
+			sp->syntax = syntax;
+			goto parsesub_return;
+endsub:
+			sp = &subs[--subnest];
+			typeloc = sp->typeloc;
+			subtype = sp->subtype;
+			flags = VSARRAY;
+			varnest--;
+			USTPUTC(CTLENDVAR, out);
+			c = pgetc();
+		}
 		if (subtype == 0) {
 			switch (c) {
 			case ':':
-				flags = VSNUL;
+				flags |= VSNUL;
 				c = pgetc();
 				/*FALLTHROUGH*/
 			default:
@@ -1975,6 +2192,46 @@ goodname(name)
 }
 
 
+/*
+ * Classify a word of a simple command:  0 if it is not an assignment,
+ * 1 for name=value, and 2 for name[subscript]=value.
+ */
+
+int
+assignword(p)
+	char *p;
+	{
+	int depth;
+
+	if (! is_name(*p))
+		return 0;
+	do
+		p++;
+	while (is_in_name(*p));
+	if (*p == '=')
+		return 1;
+	if (*p != '[')
+		return 0;
+	depth = 0;
+	for (;;) {
+		switch (*p++) {
+		case '\0':
+			return 0;
+		case CTLESC:
+			p++;
+			break;
+		case '[':
+			depth++;
+			break;
+		case ']':
+			if (--depth == 0 && *p == '=')
+				return 2;
+			break;
+		}
+	}
+}
+
+
 /*
  * Called when an unexpected token is read during the parse.  The argument
  * is the token that is expected, or -1 if more than one type of token can
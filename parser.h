@@ -54,6 +54,7 @@
 /* variable substitution byte (follows CTLVAR) */
 #define VSTYPE	0x0f		/* type of variable substitution */
 #define VSNUL	0x10		/* colon--treat the empty string as unset */
+#define VSARRAY	0x40		/* ${name[subscript]}; subscript ends with CTLENDVAR */
 #define VSQUOTE 0x80		/* inside double quotes--suppress splitting */
 
 /* values of VSTYPE field */
@@ -67,6 +68,7 @@
 #define VSTRIMRIGHT	0x8		/* ${var%pattern} */
 #define VSTRIMRIGHTMAX 	0x9		/* ${var%%pattern} */
 #define VSLENGTH	0xa		/* ${#var} */
+#define VSKEYS		0xb		/* ${!var[@]} */
 
 
 /*
@@ -101,6 +103,8 @@ extern int whichprompt;		/* 1 == PS1, 2 == PS2 */
 
 
 union node *parsecmd __P((int));
+int parseatend __P((void));
 void fixredir __P((union node *, const char *, int));
 int goodname __P((char *));
+int assignword __P((char *));
 char *getprompt __P((void *));  
@@ -45,6 +45,7 @@ static char sccsid[] = "@(#)redir.c	8.2 (Berkeley) 5/4/95";
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <spawn.h>
 
 /*
  * Code for dealing with input/output redirection.
@@ -68,6 +69,8 @@ MKINIT
 struct redirtab {
 	struct redirtab *next;
 	short renamed[10];
+	struct output *out1;		/* out1 and out2 to restore */
+	struct output *out2;
 };
 
 
@@ -89,7 +92,8 @@ STATIC int openhere __P((union node *));
  * old file descriptors are stashed away so that the redirection can be
  * undone by calling popredir.  If the REDIR_BACKQ flag is set, then the
  * standard output, and the standard error if it becomes a duplicate of
- * stdout, is saved in memory.
+ * stdout, is saved in memory.  Output which already goes to memory
+ * stays there unless it is redirected.
  */
 
 void
@@ -105,11 +109,14 @@ redirect(redir, flags)
 
 	for (i = 10 ; --i >= 0 ; )
 		memory[i] = 0;
-	memory[1] = flags & REDIR_BACKQ;
+	memory[1] = (flags & REDIR_BACKQ) || out1 == &memout;
+	memory[2] = out2 == &memout;
 	if (flags & REDIR_PUSH) {
 		sv = ckmalloc(sizeof (struct redirtab));
 		for (i = 0 ; i < 10 ; i++)
 			sv->renamed[i] = EMPTY;
+		sv->out1 = out1;
+		sv->out2 = out2;
 		sv->next = redirlist;
 		redirlist = sv;
 	}
@@ -120,6 +127,9 @@ redirect(redir, flags)
 			if ((i = copyfd(fd, 10)) != EMPTY) {
 				sv->renamed[fd] = i;
 				close(fd);
+				/* don't let programs we spawn inherit it */
+				if (i >= 0)
+					fcntl(i, F_SETFD, FD_CLOEXEC);
 			}
 			INTON;
 			if (i == EMPTY)
@@ -131,10 +141,8 @@ redirect(redir, flags)
                         fd0_redirected++;
 		openredirect(n, memory);
 	}
-	if (memory[1])
-		out1 = &memout;
-	if (memory[2])
-		out2 = &memout;
+	out1 = memory[1] ? &memout : &output;
+	out2 = memory[2] ? &memout : &errout;
 }
 
 
@@ -207,6 +215,56 @@ movefd:
 }
 
 
+/*
+ * Translate a list of redirections into file actions for posix_spawn,
+ * so that a program can be started without forking the shell.  The file
+ * names must already have been expanded.  Returns zero if the list holds
+ * something that can't be expressed this way (a here document needs a
+ * process to write it), in which case the caller has to fork instead.
+ */
+
+int
+spawnredir(redir, fa)
+	union node *redir;
+	posix_spawn_file_actions_t *fa;
+	{
+	union node *n;
+	int fd;
+	int e;
+
+	for (n = redir ; n ; n = n->nfile.next) {
+		fd = n->nfile.fd;
+		switch (n->nfile.type) {
+		case NFROM:
+			e = posix_spawn_file_actions_addopen(fa, fd,
+			    n->nfile.expfname, O_RDONLY, 0);
+			break;
+		case NTO:
+			e = posix_spawn_file_actions_addopen(fa, fd,
+			    n->nfile.expfname, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+			break;
+		case NAPPEND:
+			e = posix_spawn_file_actions_addopen(fa, fd,
+			    n->nfile.expfname, O_WRONLY|O_CREAT|O_APPEND, 0666);
+			break;
+		case NTOFD:
+		case NFROMFD:
+			if (n->ndup.dupfd < 0)
+				e = posix_spawn_file_actions_addclose(fa, fd);
+			else
+				e = posix_spawn_file_actions_adddup2(fa,
+				    n->ndup.dupfd, fd);
+			break;
+		default:
+			return 0;
+		}
+		if (e != 0)
+			return 0;
+	}
+	return 1;
+}
+
+
 /*
  * Handle here documents.  Normally we fork off a process to write the
  * data to a pipe.  If the document is short, we can stuff the data in
@@ -272,6 +330,8 @@ popredir() {
 		}
 	}
 	INTOFF;
+	out1 = rp->out1;
+	out2 = rp->out2;
 	redirlist = rp->next;
 	ckfree(rp);
 	INTON;
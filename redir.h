@@ -41,9 +41,14 @@
 #define REDIR_BACKQ 02		/* save the command output in memory */
 
 union node;
+struct redirtab;
+extern struct redirtab *redirlist;
 void redirect __P((union node *, int));
 void popredir __P((void));
 int fd0_redirected_p __P((void));
 void clearredir __P((void)); 
 int copyfd __P((int, int));
 
+#include <spawn.h>
+int spawnredir __P((union node *, posix_spawn_file_actions_t *));
+
@@ -59,6 +59,7 @@
 #define DEBUG 1
 
 typedef void *pointer;
+typedef long long arith_t;	/* the type of arithmetic values */
 #ifndef NULL
 #define NULL (void *)0
 #endif
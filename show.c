@@ -127,6 +127,7 @@ shcmd(cmd, fp)
 	FILE *fp;
 {
 	union node *np;
+	union node *ap;
 	int first;
 	char *s;
 	int dftfd;
@@ -135,7 +136,18 @@ shcmd(cmd, fp)
 	for (np = cmd->ncmd.args ; np ; np = np->narg.next) {
 		if (! first)
 			putchar(' ');
-		sharg(np, fp);
+		if (np->type == NARRAY) {
+			fputs(np->narray.text, fp);
+			putc('(', fp);
+			for (first = 1, ap = np->narray.elems ; ap ;
+			    ap = ap->narg.next, first = 0) {
+				if (! first)
+					putc(' ', fp);
+				sharg(ap, fp);
+			}
+			putc(')', fp);
+		} else
+			sharg(np, fp);
 		first = 0;
 	}
 	for (np = cmd->ncmd.redirect ; np ; np = np->nfile.next) {
@@ -192,6 +204,19 @@ sharg(arg, fp)
 
 			while (*p != '=')
 				putc(*p++, fp);
+			if (subtype & VSARRAY) {
+				putc('[', fp);
+				while (*++p != CTLENDVAR) {
+					if (*p == CTLESC)
+						putc(*++p, fp);
+					else if (*p == CTLVAR) {
+						putc('$', fp);
+						p++;
+					} else if (*p != '=')
+						putc(*p, fp);
+				}
+				putc(']', fp);
+			}
 
 			if (subtype & VSNUL)
 				putc(':', fp);
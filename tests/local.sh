@@ -0,0 +1,44 @@
+# Variables made local by a function get their old values back when it
+# returns, arrays included.  Run by make check; exits 1 on a failure.
+
+status=0
+
+check() {
+	if [ "$2" != "$3" ]; then
+		echo "local.sh: $1: got [$2], expected [$3]"
+		status=1
+	fi
+}
+
+declare -A m
+m[k]=v
+f1() { local m; }
+f1
+check "local over an associative array" "${m[k]}" v
+
+f2() { local -A m; m[z]=1; }
+f2
+check "local -A over an associative array" "${m[k]}:${m[z]}" v:
+
+f3() { declare -A m; }
+f3
+check "declare -A in a function" "${m[k]}" v
+
+a[5]=x
+g1() { local a; }
+g1
+check "local over an array without element 0" "${a[5]}" x
+
+g2() { local -a a; a[1]=y; }
+g2
+check "local -a over an array without element 0" "${a[5]}:${a[1]}" x:
+
+h1() { local new; new=1; }
+h1
+check "local creating a variable" "${new-unset}" unset
+
+h2() { local q; q[2]=3; }
+h2
+check "local creating an array" "${q[2]-unset}" unset
+
+exit $status
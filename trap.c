@@ -245,6 +245,36 @@ getsigaction(signo, sigact)
 	return 1;
 }
 
+/*
+ * Return true if any trap other than an ignored signal is set, i.e. if
+ * the shell may still have commands of its own to run.
+ */
+
+int
+havetraps()
+{
+	char **tp;
+
+	for (tp = trap ; tp <= &trap[NSIG] ; tp++)
+		if (*tp && **tp)
+			return 1;
+	return 0;
+}
+
+
+/*
+ * Return true if the signal has been ignored with "trap '' signo".  A
+ * child resetting its signals with setsignal leaves such signals alone.
+ */
+
+int
+trapignored(signo)
+	int signo;
+{
+	return trap[signo] != NULL && *trap[signo] == '\0';
+}
+
+
 /*
  * Ignore a signal.
  */
@@ -315,7 +345,7 @@ dotrap() {
 		}
 		gotsig[i - 1] = 0;
 		savestatus=exitstatus;
-		evalstring(trap[i]);
+		evalstring(trap[i], 0);
 		exitstatus=savestatus;
 	}
 done:
@@ -357,6 +387,10 @@ exitshell(status)
 	char *p;
 
 	TRACE(("exitshell(%d) pid=%d\n", status, getpid()));
+	if (backnest) {		/* leave the command substitution only */
+		exitstatus = status;
+		exraise(EXEXIT);
+	}
 	if (setjmp(loc1.loc)) {
 		goto l1;
 	}
@@ -366,7 +400,7 @@ exitshell(status)
 	handler = &loc1;
 	if ((p = trap[0]) != NULL && *p != '\0') {
 		trap[0] = NULL;
-		evalstring(p);
+		evalstring(p, 0);
 	}
 l1:   handler = &loc2;			/* probably unnecessary */
 	flushall();
@@ -41,6 +41,8 @@ extern int pendingsigs;
 int trapcmd __P((int, char **));
 void clear_traps __P((void)); 
 long setsignal __P((int)); 
+int havetraps __P((void));
+int trapignored __P((int));
 void ignoresig __P((int));
 void onsig __P((int));
 void dotrap __P((void));
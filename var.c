@@ -40,6 +40,7 @@ static char sccsid[] = "@(#)var.c	8.3 (Berkeley) 5/4/95";
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <limits.h>
 
 /*
  * Shell variables.
@@ -59,11 +60,12 @@ static char sccsid[] = "@(#)var.c	8.3 (Berkeley) 5/4/95";
 #include "error.h"
 #include "mystring.h"
 #include "myhistedit.h"
+#include "hashtab.h"
+#include "arith.h"
 
 
-#define VTABSIZE 39
-
 struct localvar *localvars;		/* list of local variables */
+struct localvar *savedvars;		/* variables saved by savevars */
 
 struct varinit {
 	struct var *var;
@@ -109,10 +111,92 @@ const struct varinit varinit[] = {
 	{NULL,	0,				NULL},
 };
 
-struct var *vartab[VTABSIZE];
+STATIC int varmatch __P((void *, const char *));
+STATIC int envmatch __P((void *, const char *));
+
+struct hashtab vartab = { varmatch };
+
+/*
+ * Variables imported from the environment are left in envtab as the
+ * original name=value strings until they are first looked up, and are
+ * passed on to children from there.  Most never get a struct var.
+ */
+STATIC struct hashtab envtab = { envmatch };
+
+/*
+ * A cache for lookupvarref, indexed by the address of the reference.
+ */
+#define VARREFSIZE 64
+
+struct varref {
+	char *name;		/* the reference */
+	struct var *vp;		/* the variable it named */
+	int gen;		/* vargen when the entry was made */
+};
+
+STATIC struct varref varrefs[VARREFSIZE];
+STATIC int vargen;		/* bumped when a struct var is freed */
+
+/*
+ * An element of an associative array.  The elements are hashed on
+ * their keys, and also kept in a vector in the order in which they
+ * were first set, which is the order they are expanded in.
+ */
+
+#define ARB 1			/* actual size determined at run time */
+
+struct velem {
+	char *val;		/* the value */
+	int order;		/* index in the keys vector */
+	char key[ARB];		/* the key */
+};
+
+struct vassoc {
+	struct hashtab tab;	/* the elements, by key */
+	struct velem **keys;	/* the elements in order, NULL if unset */
+	int nkeys;		/* entries used in keys */
+	int size;		/* entries allocated for keys */
+};
+
+STATIC char **envcache;			/* the exported variables */
+STATIC int nenvcache;
+STATIC int envdirty = 1;		/* envcache is out of date */
 
+STATIC void savevar __P((struct var *));
+STATIC int intval __P((char *, arith_t *));
+STATIC void makeint __P((char *));
+STATIC char *varval __P((struct var *));
+STATIC void fmtvar __P((struct var *));
 STATIC int unsetvar __P((char *));
-STATIC struct var **hashvar __P((char *));
+STATIC int unsetelem __P((char *, char *));
+STATIC char *splitsub __P((char *, char **));
+STATIC int subindex __P((char *));
+STATIC struct var *makearray __P((char *));
+STATIC struct var *makeassoc __P((char *));
+STATIC void putelem __P((struct var *, int, char *));
+STATIC char *intelem __P((struct var *, char *, char *));
+STATIC char *lookupelem __P((char *, int));
+STATIC char *elem __P((struct var *, int));
+STATIC int varraysize __P((struct var *));
+STATIC struct varray *duparray __P((struct varray *));
+STATIC void freearray __P((struct varray *));
+STATIC void setkey __P((struct var *, char *, char *));
+STATIC struct velem *findkey __P((struct vassoc *, char *));
+STATIC void putkey __P((struct vassoc *, char *, char *));
+STATIC void delkey __P((struct vassoc *, struct velem *));
+STATIC struct vassoc *newassoc __P((void));
+STATIC struct vassoc *dupassoc __P((struct vassoc *));
+STATIC void freeassoc __P((struct vassoc *));
+STATIC int velemmatch __P((void *, const char *));
+STATIC void savearrays __P((struct localvar *, struct var *));
+STATIC void restorearrays __P((struct var *, struct localvar *));
+STATIC void freearrays __P((struct var *));
+STATIC void showarray __P((struct var *));
+STATIC struct hashent *varslot __P((char *));
+STATIC struct var *findvar __P((char *));
+STATIC struct var *findvarref __P((char *));
+STATIC struct var *findnumref __P((struct numref *));
+STATIC void importenv __P((void));
 STATIC int varequal __P((char *, char *));
 
 /*
@@ -121,18 +205,39 @@ STATIC int varequal __P((char *, char *));
 
 #ifdef mkinit
 INCLUDE "var.h"
+MKINIT void initenv();
+
 INIT {
+	initvar();
+	initenv();
+}
+#endif
+
+
+/*
+ * Import the environment into envtab.
+ */
+
+void
+initenv() {
 	char **envp;
 	extern char **environ;
+	struct hashent *hp;
+	unsigned hash;
 
-	initvar();
 	for (envp = environ ; *envp ; envp++) {
-		if (strchr(*envp, '=')) {
+		if (strchr(*envp, '=') == NULL)
+			continue;
+		/* the variables in varinit are used directly, so set them */
+		hash = hashstr(*envp);
+		if (htlookup(&vartab, *envp, hash) != NULL)
 			setvareq(*envp, VEXPORT|VTEXTFIXED);
-		}
+		else if ((hp = htlookup(&envtab, *envp, hash)) != NULL)
+			hp->ent = *envp;
+		else
+			htadd(&envtab, *envp, hash);
 	}
 }
-#endif
 
 
 /*
@@ -144,13 +249,10 @@ void
 initvar() {
 	const struct varinit *ip;
 	struct var *vp;
-	struct var **vpp;
 
 	for (ip = varinit ; (vp = ip->var) != NULL ; ip++) {
 		if ((vp->flags & VEXPORT) == 0) {
-			vpp = hashvar(ip->text);
-			vp->next = *vpp;
-			*vpp = vp;
+			htadd(&vartab, vp, hashstr(ip->text));
 			vp->text = ip->text;
 			vp->flags = ip->flags;
 		}
@@ -159,9 +261,7 @@ initvar() {
 	 * PS1 depends on uid
 	 */
 	if ((vps1.flags & VEXPORT) == 0) {
-		vpp = hashvar("PS1=");
-		vps1.next = *vpp;
-		*vpp = &vps1;
+		htadd(&vartab, &vps1, hashstr("PS1="));
 		vps1.text = geteuid() ? "PS1=ash-0.3@ " : "PS1=ash-0.3# ";
 		vps1.flags = VSTRFIXED|VTEXTFIXED;
 	}
@@ -216,93 +316,1013 @@ setvar(name, val, flags)
 }
 
 
-
+
+/*
+ * Same as setvar except that the variable and value are passed in
+ * the first argument as name=value.  Since the first argument will
+ * be actually stored in the table, it should not be a string that
+ * will go away.
+ */
+
+void
+setvareq(s, flags)
+	char *s;
+	int flags;
+{
+	struct var *vp;
+	arith_t n;
+	int stale;
+
+	n = 0;
+	stale = 0;
+	if ((vp = findvar(s)) != NULL) {
+		if (vp->flags & VREADONLY) {
+			int len = strchr(s, '=') - s;
+			error("%.*s: is read only", len, s);
+		}
+		if ((vp->flags | flags) & VINTEGER && (flags & VUNSET) == 0)
+			stale = intval(strchr(s, '=') + 1, &n);
+		INTOFF;
+		savevar(vp);
+		if ((vp->flags | flags) & VEXPORT)
+			envdirty = 1;
+		if (vp == &vpath)
+			changepath(s + 5);	/* 5 = strlen("PATH=") */
+		if ((vp->flags & (VTEXTFIXED|VSTACK)) == 0)
+			ckfree(vp->text);
+		vp->flags &=~ (VTEXTFIXED|VSTACK|VUNSET|VNOTEXT);
+		vp->flags |= flags;
+		vp->text = s;
+		vp->ival = n;
+		if (stale)
+			vp->flags |= VNOTEXT;
+		if (vp == &vmpath || (vp == &vmail && ! mpathset()))
+			chkmail(1);
+#ifndef NO_HISTORY
+		if (vp == &vhistsize)
+			sethistsize();
+#endif
+		INTON;
+		return;
+	}
+	/* not found */
+	if ((flags & (VINTEGER|VUNSET)) == VINTEGER)
+		stale = intval(strchr(s, '=') + 1, &n);
+	INTOFF;
+	vp = ckmalloc(sizeof (*vp));
+	vp->flags = flags | (stale ? VNOTEXT : 0);
+	vp->text = NULL;
+	vp->ival = n;
+	vp->array = NULL;
+	vp->assoc = NULL;
+	htadd(&vartab, vp, hashstr(s));
+	if (flags & VEXPORT)
+		envdirty = 1;
+	savevar(vp);
+	vp->text = s;
+	INTON;
+}
+
+
+
+/*
+ * The number assigned to an integer variable by the value p.  Returns
+ * nonzero if p is not the number written in decimal, and so cannot be
+ * kept as the text of the variable.
+ */
+
+STATIC int
+intval(p, np)
+	char *p;
+	arith_t *np;
+{
+	char *q;
+
+	q = p;
+	if (*q == '-')
+		q++;
+	if (is_digit(*q) && (*q != '0' || (q == p && q[1] == '\0'))) {
+		while (is_digit(*q))
+			q++;
+		if (*q == '\0' && q - p <= 18) {	/* no overflow */
+			*np = strtoll(p, NULL, 10);
+			return 0;
+		}
+	}
+	*np = *p ? arith(p) : 0;
+	return 1;
+}
+
+
+
+/*
+ * Process a linked list of variable assignments.
+ */
+
+void
+listsetvar(list)
+	struct strlist *list;
+	{
+	struct strlist *lp;
+
+	INTOFF;
+	for (lp = list ; lp ; lp = lp->next) {
+		setvareq(savestr(lp->text), 0);
+	}
+	INTON;
+}
+
+
+
+/*
+ * Find the value of a variable.  Returns NULL if not set.
+ */
+
+char *
+lookupvar(name)
+	char *name;
+	{
+	struct var *v;
+
+	if ((v = findvar(name)) == NULL || (v->flags & VUNSET))
+		return NULL;
+	return varval(v);
+}
+
+
+
+/*
+ * Like lookupvar, for a variable reference in a parse tree.  The variable
+ * found is remembered under the address of the reference, so expanding
+ * the same reference again, as in a loop, does not hash the name.  An
+ * entry is good while vargen is unchanged; the name is checked as well
+ * since the tree may have been freed and its memory reused.
+ */
+
+char *
+lookupvarref(name)
+	char *name;
+	{
+	struct var *vp;
+
+	if ((vp = findvarref(name)) == NULL || (vp->flags & VUNSET))
+		return NULL;
+	return varval(vp);
+}
+
+
+/*
+ * The value of a variable in arithmetic.  An integer variable gives its
+ * number without going through text.
+ */
+
+arith_t
+getnum(rp)
+	struct numref *rp;
+	{
+	struct var *vp;
+
+	if ((vp = findnumref(rp)) == NULL || (vp->flags & VUNSET))
+		return 0;
+	if (vp->flags & VINTEGER)
+		return vp->ival;
+	return strtoll(strchr(vp->text, '=') + 1, NULL, 0);
+}
+
+
+/*
+ * Assign a number from arithmetic to a variable.  An integer variable
+ * just takes the number, and its text is made when it is needed.
+ */
+
+void
+setnum(rp, n)
+	struct numref *rp;
+	arith_t n;
+	{
+	struct var *vp;
+	char buf[ARITH_MAX_LEN];
+
+	if ((vp = findnumref(rp)) == NULL
+	 || (vp->flags & (VINTEGER|VREADONLY)) != VINTEGER) {
+		setvar(rp->name, fmtarith(n, buf), 0);
+		return;
+	}
+	INTOFF;
+	savevar(vp);
+	if (vp->flags & VEXPORT)
+		envdirty = 1;
+	vp->ival = n;
+	vp->flags &=~ VUNSET;
+	vp->flags |= VNOTEXT;
+	INTON;
+}
+
+
+/*
+ * Whether a variable used in arithmetic is an associative array.
+ */
+
+int
+isassocref(rp)
+	struct numref *rp;
+	{
+	struct var *vp;
+
+	return (vp = findnumref(rp)) != NULL && (vp->flags & VASSOC);
+}
+
+
+/*
+ * Like getnum, for element index of an array, or element key of an
+ * associative array.
+ */
+
+arith_t
+getelemnum(rp, index, key)
+	struct numref *rp;
+	arith_t index;
+	char *key;
+{
+	struct var *vp;
+	struct velem *ep;
+	char *p;
+
+	if ((vp = findnumref(rp)) == NULL)
+		return 0;
+	if (vp->flags & VASSOC) {
+		if ((ep = findkey(vp->assoc, key)) == NULL)
+			return 0;
+		p = ep->val;
+	} else {
+		if (index < 0)
+			index += varraysize(vp);
+		if (index == 0)
+			return getnum(rp);
+		if (index < 0 || index > INT_MAX
+		 || (p = elem(vp, (int)index)) == NULL)
+			return 0;
+	}
+	return strtoll(p, NULL, 0);
+}
+
+
+/*
+ * Like setnum, for an element.
+ */
+
+void
+setelemnum(rp, index, key, n)
+	struct numref *rp;
+	arith_t index;
+	char *key;
+	arith_t n;
+{
+	struct var *vp;
+	char buf[ARITH_MAX_LEN];
+
+	if ((vp = findnumref(rp)) != NULL && (vp->flags & VASSOC)) {
+		setkey(vp, key, fmtarith(n, buf));
+		return;
+	}
+	if (index < 0 && vp != NULL)
+		index += varraysize(vp);
+	if (index < 0 || index > INT_MAX)
+		error("%s: bad array subscript", rp->name);
+	if (index == 0)
+		setnum(rp, n);
+	else
+		putelem(makearray(rp->name), (int)index, fmtarith(n, buf));
+}
+
+
+/*
+ * The value of a variable as text.  The text of an integer variable is
+ * only made from its number when it is asked for.
+ */
+
+STATIC char *
+varval(vp)
+	struct var *vp;
+	{
+	if (vp->flags & VNOTEXT)
+		fmtvar(vp);
+	return strchr(vp->text, '=') + 1;
+}
+
+
+STATIC void
+fmtvar(vp)
+	struct var *vp;
+	{
+	char buf[ARITH_MAX_LEN];
+	char *num;
+	char *p;
+	int namelen;
+
+	num = fmtarith(vp->ival, buf);
+	namelen = strchr(vp->text, '=') - vp->text + 1;
+	INTOFF;
+	p = ckmalloc(namelen + strlen(num) + 1);
+	memcpy(p, vp->text, namelen);
+	scopy(num, p + namelen);
+	if ((vp->flags & (VTEXTFIXED|VSTACK)) == 0)
+		ckfree(vp->text);
+	vp->text = p;
+	vp->flags &=~ (VTEXTFIXED|VSTACK|VNOTEXT);
+	if (vp->flags & VEXPORT)
+		envdirty = 1;
+	INTON;
+}
+
+
+STATIC struct var *
+findnumref(rp)
+	struct numref *rp;
+	{
+	if (rp->vp == NULL || rp->gen != vargen) {
+		rp->vp = findvar(rp->name);
+		rp->gen = vargen;
+	}
+	return rp->vp;
+}
+
+
+STATIC struct var *
+findvarref(name)
+	char *name;
+	{
+	struct varref *rp;
+	struct var *vp;
+
+	rp = &varrefs[((unsigned long)name ^ (unsigned long)name >> 6)
+	    % VARREFSIZE];
+	if (rp->name == name && rp->gen == vargen
+	 && varequal(rp->vp->text, name))
+		return rp->vp;
+	if ((vp = findvar(name)) == NULL)
+		return NULL;
+	rp->name = name;
+	rp->vp = vp;
+	rp->gen = vargen;
+	return vp;
+}
+
+
+
+/*
+ * Set element index of the array name.  Element 0 is the value of the
+ * variable, so setting it is the same as an ordinary assignment.  A
+ * negative index counts back from the end of the array.
+ */
+
+void
+setelem(name, index, val)
+	char *name;
+	int index;
+	char *val;
+{
+	struct var *vp;
+	char buf[ARITH_MAX_LEN];
+
+	if (index < 0 && (vp = findvar(name)) != NULL)
+		index += varraysize(vp);
+	if (index < 0)
+		error("%s[%d]: bad array subscript", name, index);
+	if (index == 0)
+		setvar(name, val, 0);
+	else {
+		vp = makearray(name);
+		putelem(vp, index, intelem(vp, val, buf));
+	}
+}
+
+
+/*
+ * Like setelem, with the arguments in a single string of the form
+ * name[subscript]=value.  The subscript is a key if name is an
+ * associative array and an arithmetic expression otherwise.  The
+ * string is modified.
+ */
+
+void
+setelemeq(s)
+	char *s;
+	{
+	struct var *vp;
+	char *p, *sub, *val;
+	char buf[ARITH_MAX_LEN];
+
+	p = strchr(s, '[');
+	if ((sub = splitsub(p, &val)) == NULL)
+		error("%s: bad array subscript", s);
+	*p = '\0';
+	if ((vp = findvar(s)) != NULL && (vp->flags & VASSOC))
+		setkey(vp, sub, intelem(vp, val, buf));
+	else
+		setelem(s, subindex(sub), val);
+}
+
+
+/*
+ * Split a string [subscript]=value, starting at the '['.  Returns the
+ * subscript, or NULL if the string is not of this form, and sets *valp
+ * to the value.  The string is modified.
+ */
+
+STATIC char *
+splitsub(p, valp)
+	char *p;
+	char **valp;
+{
+	char *q;
+	int depth;
+
+	depth = 0;
+	for (q = p ; *q ; q++) {
+		if (*q == '[')
+			depth++;
+		else if (*q == ']' && --depth == 0 && q[1] == '=') {
+			*q = '\0';
+			*valp = q + 2;
+			return p + 1;
+		}
+	}
+	return NULL;
+}
+
+
+/*
+ * Evaluate the subscript of an indexed array.
+ */
+
+STATIC int
+subindex(sub)
+	char *sub;
+	{
+	arith_t n;
+
+	n = arith(sub);
+	if (n > INT_MAX || n < -INT_MAX)
+		error("%s: subscript out of range", sub);
+	return n;
+}
+
+
+/*
+ * Assign the strings in list to the array name, replacing its old
+ * elements or, if append is set, adding them after the last one.  A
+ * string of the form [subscript]=value sets the element given by the
+ * subscript; the elements of an associative array must all be given
+ * this way.  An indexed array continues from the element set last.
+ */
+
+void
+setarray(name, list, append)
+	char *name;
+	struct strlist *list;
+	int append;
+{
+	struct var *vp;
+	struct strlist *sp;
+	char *sub, *val;
+	int index;
+	char buf[ARITH_MAX_LEN];
+
+	if ((vp = findvar(name)) != NULL && (vp->flags & VASSOC)) {
+		if (vp->flags & VREADONLY)
+			error("%s: is read only", name);
+		if (! append) {
+			INTOFF;
+			savevar(vp);
+			freeassoc(vp->assoc);
+			vp->assoc = newassoc();
+			INTON;
+		}
+		for (sp = list ; sp ; sp = sp->next) {
+			if (sp->text[0] != '['
+			 || (sub = splitsub(sp->text, &val)) == NULL)
+				error("%s: %s: need [key]=value", name, sp->text);
+			setkey(vp, sub, intelem(vp, val, buf));
+		}
+		return;
+	}
+	index = 0;
+	if (append && vp != NULL)
+		index = varraysize(vp);
+	if (! append) {
+		setvar(name, NULL, 0);
+		vp = makearray(name);
+		INTOFF;
+		freearray(vp->array);
+		vp->array = ckmalloc(sizeof *vp->array);
+		vp->array->nvals = vp->array->nset = vp->array->size = 0;
+		vp->array->vals = NULL;
+		INTON;
+	} else
+		vp = makearray(name);
+	for (sp = list ; sp ; sp = sp->next) {
+		val = sp->text;
+		if (val[0] == '[' && (sub = splitsub(val, &val)) != NULL)
+			if ((index = subindex(sub)) < 0)
+				index += varraysize(vp);
+		if (index < 0)
+			error("%s[%d]: bad array subscript", name, index);
+		if (index == 0)
+			setvar(name, val, 0);
+		else
+			putelem(vp, index, intelem(vp, val, buf));
+		index++;
+	}
+}
+
+
+/*
+ * Return the element of the array named by a parse-tree reference
+ * which the expanded subscript sub selects, or NULL if it is not set.
+ */
+
+char *
+lookupsub(name, sub)
+	char *name;
+	char *sub;
+{
+	struct var *vp;
+	struct velem *ep;
+
+	if ((vp = findvarref(name)) != NULL && (vp->flags & VASSOC)) {
+		if ((ep = findkey(vp->assoc, sub)) == NULL)
+			return NULL;
+		return ep->val;
+	}
+	return lookupelem(name, subindex(sub));
+}
+
+
+STATIC char *
+lookupelem(name, index)
+	char *name;
+	int index;
+{
+	struct var *vp;
+
+	if ((vp = findvarref(name)) == NULL)
+		return NULL;
+	if (index < 0 && (index += varraysize(vp)) < 0)
+		return NULL;
+	return elem(vp, index);
+}
+
+
+/*
+ * Element index of a variable.  A variable which is not an array has
+ * only element 0.
+ */
+
+STATIC char *
+elem(vp, index)
+	struct var *vp;
+	int index;
+{
+	if (index == 0) {
+		if (vp->flags & VUNSET)
+			return NULL;
+		return varval(vp);
+	}
+	if ((vp->flags & VARRAY) == 0 || index >= vp->array->nvals)
+		return NULL;
+	return vp->array->vals[index];
+}
+
+
+/*
+ * Step through the set elements of an array:  *posp is 0 to begin
+ * with, and each call returns the value of the next element, or NULL
+ * after the last.  For an associative array *keyp is set to the key;
+ * otherwise it is set to NULL and the index is *posp - 1.
+ */
+
+char *
+nextelem(name, posp, keyp)
+	char *name;
+	int *posp;
+	char **keyp;
+{
+	struct var *vp;
+	struct vassoc *ap;
+	struct velem *ep;
+	char *p;
+	int n;
+
+	if ((vp = findvarref(name)) == NULL)
+		return NULL;
+	if (vp->flags & VASSOC) {
+		ap = vp->assoc;
+		while (*posp < ap->nkeys) {
+			if ((ep = ap->keys[(*posp)++]) != NULL) {
+				*keyp = ep->key;
+				return ep->val;
+			}
+		}
+		return NULL;
+	}
+	*keyp = NULL;
+	n = varraysize(vp);
+	while (*posp < n) {
+		if ((p = elem(vp, (*posp)++)) != NULL)
+			return p;
+	}
+	return NULL;
+}
+
+
+/*
+ * The number of set elements of an array.
+ */
+
+int
+arraycount(name)
+	char *name;
+	{
+	struct var *vp;
+	int n;
+
+	if ((vp = findvarref(name)) == NULL)
+		return 0;
+	if (vp->flags & VASSOC)
+		return vp->assoc->tab.nent;
+	n = (vp->flags & VUNSET) == 0;
+	if (vp->flags & VARRAY)
+		n += vp->array->nset;
+	return n;
+}
+
+
+/*
+ * Make a variable an array, creating it if necessary, so that an
+ * element other than 0 can be stored.
+ */
+
+STATIC struct var *
+makearray(name)
+	char *name;
+	{
+	struct var *vp;
+
+	if ((vp = findvar(name)) == NULL) {
+		setvar(name, NULL, 0);
+		vp = findvar(name);
+	} else if (vp->flags & VREADONLY) {
+		error("%s: is read only", name);
+	} else if (vp->flags & VASSOC) {
+		error("%s: is an associative array", name);
+	}
+	INTOFF;
+	savevar(vp);
+	if ((vp->flags & VARRAY) == 0) {
+		if (vp->flags & VEXPORT)
+			envdirty = 1;	/* arrays are not exported */
+		vp->array = ckmalloc(sizeof *vp->array);
+		vp->array->nvals = vp->array->nset = vp->array->size = 0;
+		vp->array->vals = NULL;
+		vp->flags |= VARRAY;
+	}
+	INTON;
+	return vp;
+}
+
+
+/*
+ * Store element index, which must be at least 1, of an array.  The
+ * value is copied.  The vector grows by doubling.
+ */
+
+STATIC void
+putelem(vp, index, val)
+	struct var *vp;
+	int index;
+	char *val;
+{
+	struct varray *ap;
+	int size;
+
+	INTOFF;
+	ap = vp->array;
+	if (index >= ap->size) {
+		size = ap->size ? ap->size * 2 : 8;
+		if (size <= index)
+			size = index + 1;
+		ap->vals = ckrealloc(ap->vals, size * sizeof *ap->vals);
+		memset(ap->vals + ap->size, 0,
+		    (size - ap->size) * sizeof *ap->vals);
+		ap->size = size;
+	}
+	if (ap->vals[index])
+		ckfree(ap->vals[index]);
+	else
+		ap->nset++;
+	ap->vals[index] = savestr(val);
+	if (index >= ap->nvals)
+		ap->nvals = index + 1;
+	INTON;
+}
+
+
+/*
+ * The value to store in an element of vp:  val, or if vp is an integer
+ * variable the value of val as an expression, formatted in buf.
+ */
+
+STATIC char *
+intelem(vp, val, buf)
+	struct var *vp;
+	char *val;
+	char *buf;
+{
+	if (vp->flags & VINTEGER)
+		return fmtarith(arith(val), buf);
+	return val;
+}
+
+
+STATIC int
+varraysize(vp)
+	struct var *vp;
+	{
+	if ((vp->flags & VARRAY) && vp->array->nvals > 0)
+		return vp->array->nvals;
+	return (vp->flags & VUNSET) == 0;
+}
+
+
+STATIC struct varray *
+duparray(ap)
+	struct varray *ap;
+	{
+	struct varray *new;
+	int i;
+
+	if (ap == NULL)
+		return NULL;
+	new = ckmalloc(sizeof *new);
+	*new = *ap;
+	new->size = ap->nvals;
+	new->vals = NULL;
+	if (new->size > 0) {
+		new->vals = ckmalloc(new->size * sizeof *new->vals);
+		for (i = 0 ; i < new->size ; i++)
+			new->vals[i] = ap->vals[i] ? savestr(ap->vals[i]) : NULL;
+	}
+	return new;
+}
+
+
+STATIC void
+freearray(ap)
+	struct varray *ap;
+	{
+	int i;
+
+	if (ap == NULL)
+		return;
+	for (i = 0 ; i < ap->nvals ; i++)
+		if (ap->vals[i])
+			ckfree(ap->vals[i]);
+	if (ap->vals)
+		ckfree(ap->vals);
+	ckfree(ap);
+}
+
+
+/*
+ * Make a variable an associative array, creating it if necessary.
+ */
+
+STATIC struct var *
+makeassoc(name)
+	char *name;
+	{
+	struct var *vp;
+
+	if ((vp = findvar(name)) == NULL) {
+		setvar(name, NULL, 0);
+		vp = findvar(name);
+	} else if (vp->flags & VREADONLY) {
+		error("%s: is read only", name);
+	} else if (vp->flags & VARRAY) {
+		error("%s: is an indexed array", name);
+	}
+	INTOFF;
+	savevar(vp);
+	if ((vp->flags & VASSOC) == 0) {
+		if (vp->flags & VEXPORT)
+			envdirty = 1;
+		vp->assoc = newassoc();
+		vp->flags |= VASSOC;
+	}
+	INTON;
+	return vp;
+}
+
+
+/*
+ * Set an element of an associative array.
+ */
+
+STATIC void
+setkey(vp, key, val)
+	struct var *vp;
+	char *key;
+	char *val;
+{
+	if (vp->flags & VREADONLY)
+		error("%.*s: is read only", strchr(vp->text, '=') - vp->text,
+		    vp->text);
+	INTOFF;
+	savevar(vp);
+	putkey(vp->assoc, key, val);
+	INTON;
+}
+
+
+STATIC struct velem *
+findkey(ap, key)
+	struct vassoc *ap;
+	char *key;
+	{
+	struct hashent *hp;
+
+	if ((hp = htlookup(&ap->tab, key, hashkey(key))) == NULL)
+		return NULL;
+	return hp->ent;
+}
+
+
+/*
+ * Add or replace an element.  The key and value are copied.
+ */
+
+STATIC void
+putkey(ap, key, val)
+	struct vassoc *ap;
+	char *key;
+	char *val;
+{
+	struct hashent *hp;
+	struct velem *ep;
+	unsigned hash;
+
+	INTOFF;
+	hash = hashkey(key);
+	if ((hp = htlookup(&ap->tab, key, hash)) != NULL) {
+		ep = hp->ent;
+		ckfree(ep->val);
+		ep->val = savestr(val);
+		INTON;
+		return;
+	}
+	if (ap->nkeys >= ap->size) {
+		ap->size = ap->size ? ap->size * 2 : 8;
+		ap->keys = ckrealloc(ap->keys, ap->size * sizeof *ap->keys);
+	}
+	ep = ckmalloc(sizeof (struct velem) - ARB + strlen(key) + 1);
+	scopy(key, ep->key);
+	ep->val = savestr(val);
+	ep->order = ap->nkeys;
+	ap->keys[ap->nkeys++] = ep;
+	htadd(&ap->tab, ep, hash);
+	INTON;
+}
+
+
 /*
- * Same as setvar except that the variable and value are passed in
- * the first argument as name=value.  Since the first argument will
- * be actually stored in the table, it should not be a string that
- * will go away.
+ * Remove an element.  The keys vector is packed once it is more than
+ * half holes.
  */
 
-void
-setvareq(s, flags)
-	char *s;
-	int flags;
-{
-	struct var *vp, **vpp;
-
-	vpp = hashvar(s);
-	for (vp = *vpp ; vp ; vp = vp->next) {
-		if (varequal(s, vp->text)) {
-			if (vp->flags & VREADONLY) {
-				int len = strchr(s, '=') - s;
-				error("%.*s: is read only", len, s);
+STATIC void
+delkey(ap, ep)
+	struct vassoc *ap;
+	struct velem *ep;
+	{
+	int i, j;
+
+	INTOFF;
+	htdelete(&ap->tab, htlookup(&ap->tab, ep->key, hashkey(ep->key)));
+	ap->keys[ep->order] = NULL;
+	ckfree(ep->val);
+	ckfree(ep);
+	if (ap->nkeys > 2 * ap->tab.nent + 8) {
+		for (i = j = 0 ; i < ap->nkeys ; i++) {
+			if ((ep = ap->keys[i]) != NULL) {
+				ep->order = j;
+				ap->keys[j++] = ep;
 			}
-			INTOFF;
-			if (vp == &vpath)
-				changepath(s + 5);	/* 5 = strlen("PATH=") */
-			if ((vp->flags & (VTEXTFIXED|VSTACK)) == 0)
-				ckfree(vp->text);
-			vp->flags &=~ (VTEXTFIXED|VSTACK|VUNSET);
-			vp->flags |= flags;
-			vp->text = s;
-			if (vp == &vmpath || (vp == &vmail && ! mpathset()))
-				chkmail(1);
-#ifndef NO_HISTORY
-			if (vp == &vhistsize)
-				sethistsize();
-#endif
-			INTON;
-			return;
 		}
+		ap->nkeys = j;
 	}
-	/* not found */
-	vp = ckmalloc(sizeof (*vp));
-	vp->flags = flags;
-	vp->text = s;
-	vp->next = *vpp;
-	*vpp = vp;
+	INTON;
 }
 
 
+STATIC struct vassoc *
+newassoc() {
+	struct vassoc *ap;
 
-/*
- * Process a linked list of variable assignments.
- */
+	ap = ckmalloc(sizeof *ap);
+	ap->tab.match = velemmatch;
+	ap->tab.size = ap->tab.nent = ap->tab.nused = 0;
+	ap->tab.tab = NULL;
+	ap->keys = NULL;
+	ap->nkeys = ap->size = 0;
+	return ap;
+}
 
-void
-listsetvar(list)
-	struct strlist *list;
+
+STATIC struct vassoc *
+dupassoc(ap)
+	struct vassoc *ap;
 	{
-	struct strlist *lp;
+	struct vassoc *new;
+	int i;
 
-	INTOFF;
-	for (lp = list ; lp ; lp = lp->next) {
-		setvareq(savestr(lp->text), 0);
+	if (ap == NULL)
+		return NULL;
+	new = newassoc();
+	for (i = 0 ; i < ap->nkeys ; i++)
+		if (ap->keys[i])
+			putkey(new, ap->keys[i]->key, ap->keys[i]->val);
+	return new;
+}
+
+
+STATIC void
+freeassoc(ap)
+	struct vassoc *ap;
+	{
+	int i;
+
+	if (ap == NULL)
+		return;
+	for (i = 0 ; i < ap->nkeys ; i++) {
+		if (ap->keys[i]) {
+			ckfree(ap->keys[i]->val);
+			ckfree(ap->keys[i]);
+		}
 	}
-	INTON;
+	if (ap->keys)
+		ckfree(ap->keys);
+	htclear(&ap->tab);
+	ckfree(ap);
 }
 
 
+STATIC int
+velemmatch(ent, key)
+	void *ent;
+	const char *key;
+	{
+	return strcmp(((struct velem *)ent)->key, key) == 0;
+}
+
 
 /*
- * Find the value of a variable.  Returns NULL if not set.
+ * The elements of a variable are handed over to a localvar structure
+ * when the variable is saved, the variable keeping a copy, and handed
+ * back when it is restored.
  */
 
-char *
-lookupvar(name)
-	char *name;
+STATIC void
+savearrays(lvp, vp)
+	struct localvar *lvp;
+	struct var *vp;
 	{
-	struct var *v;
+	lvp->array = vp->array;
+	vp->array = duparray(vp->array);
+	lvp->assoc = vp->assoc;
+	vp->assoc = dupassoc(vp->assoc);
+}
 
-	for (v = *hashvar(name) ; v ; v = v->next) {
-		if (varequal(v->text, name)) {
-			if (v->flags & VUNSET)
-				return NULL;
-			return strchr(v->text, '=') + 1;
-		}
-	}
-	return NULL;
+
+STATIC void
+restorearrays(vp, lvp)
+	struct var *vp;
+	struct localvar *lvp;
+	{
+	freearrays(vp);
+	vp->array = lvp->array;
+	vp->assoc = lvp->assoc;
+}
+
+
+STATIC void
+freearrays(vp)
+	struct var *vp;
+	{
+	freearray(vp->array);
+	vp->array = NULL;
+	freeassoc(vp->assoc);
+	vp->assoc = NULL;
 }
 
 
@@ -325,42 +1345,101 @@ bltinlookup(name, doall)
 		if (varequal(sp->text, name))
 			return strchr(sp->text, '=') + 1;
 	}
-	for (v = *hashvar(name) ; v ; v = v->next) {
-		if (varequal(v->text, name)) {
-			if ((v->flags & VUNSET)
-			 || (!doall && (v->flags & VEXPORT) == 0))
-				return NULL;
-			return strchr(v->text, '=') + 1;
-		}
-	}
-	return NULL;
+	if ((v = findvar(name)) == NULL || (v->flags & VUNSET)
+	 || (!doall && (v->flags & VEXPORT) == 0))
+		return NULL;
+	return varval(v);
 }
 
 
 
 /*
  * Generate a list of exported variables.  This routine is used to construct
- * the third argument to execve when executing a program.
+ * the third argument to execve when executing a program.  The list is
+ * kept between calls and only rebuilt after something that changes an
+ * exported variable has set envdirty, so the caller must not modify it.
  */
 
 char **
 environment() {
 	int nenv;
-	struct var **vpp;
+	struct hashent *hp;
 	struct var *vp;
-	char **env, **ep;
+	char **ep;
+
+	if (! envdirty)
+		return envcache;
+	INTOFF;
+	nenv = envtab.nent;
+	HTFOREACH(hp, &vartab) {
+		vp = hp->ent;
+		if ((vp->flags & (VEXPORT|VARRAY|VASSOC)) == VEXPORT)
+			nenv++;
+	}
+	if (envcache)
+		ckfree(envcache);
+	ep = envcache = ckmalloc((nenv + 1) * sizeof *envcache);
+	nenvcache = nenv;
+	HTFOREACH(hp, &envtab)
+		*ep++ = hp->ent;
+	HTFOREACH(hp, &vartab) {
+		vp = hp->ent;
+		if ((vp->flags & (VEXPORT|VARRAY|VASSOC)) == VEXPORT) {
+			if (vp->flags & VNOTEXT)
+				fmtvar(vp);
+			*ep++ = vp->text;
+		}
+	}
+	*ep = NULL;
+	envdirty = 0;
+	INTON;
+	return envcache;
+}
+
+
+/*
+ * Like environment, but with the temporary assignments in list applied
+ * on top, the way the child of a fork would see them after setvareq.
+ * This lets a program be run without touching the variable table, or
+ * the cached list.  Returns NULL if one of the assignments names a
+ * readonly variable, so that the caller can take the normal path and
+ * report the error.
+ */
 
-	nenv = 0;
-	for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++) {
-		for (vp = *vpp ; vp ; vp = vp->next)
-			if (vp->flags & VEXPORT)
-				nenv++;
+char **
+listenvironment(list)
+	struct strlist *list;
+	{
+	int nenv;
+	struct var *vp;
+	struct strlist *sp, *lp;
+	char **env, **ep, **cp;
+
+	env = environment();
+	if (list == NULL)
+		return env;
+	nenv = nenvcache;
+	for (sp = list ; sp ; sp = sp->next) {
+		if ((vp = findvar(sp->text)) != NULL
+		 && (vp->flags & VREADONLY))
+			return NULL;
+		nenv++;
+	}
+	ep = stalloc((nenv + 1) * sizeof *env);
+	for (cp = env, env = ep ; *cp ; cp++) {
+		for (sp = list ; sp ; sp = sp->next)
+			if (varequal(sp->text, *cp))
+				break;
+		if (sp == NULL)
+			*ep++ = *cp;
 	}
-	ep = env = stalloc((nenv + 1) * sizeof *env);
-	for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++) {
-		for (vp = *vpp ; vp ; vp = vp->next)
-			if (vp->flags & VEXPORT)
-				*ep++ = vp->text;
+	for (sp = list ; sp ; sp = sp->next) {
+		/* a later assignment to the same name wins */
+		for (lp = sp->next ; lp ; lp = lp->next)
+			if (varequal(sp->text, lp->text))
+				break;
+		if (lp == NULL)
+			*ep++ = sp->text;
 	}
 	*ep = NULL;
 	return env;
@@ -383,26 +1462,28 @@ SHELLPROC {
 
 void
 shprocvar() {
-	struct var **vpp;
-	struct var *vp, **prev;
-
-	for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++) {
-		for (prev = vpp ; (vp = *prev) != NULL ; ) {
-			if ((vp->flags & VEXPORT) == 0) {
-				*prev = vp->next;
-				if ((vp->flags & VTEXTFIXED) == 0)
-					ckfree(vp->text);
-				if ((vp->flags & VSTRFIXED) == 0)
-					ckfree(vp);
-			} else {
-				if (vp->flags & VSTACK) {
-					vp->text = savestr(vp->text);
-					vp->flags &=~ VSTACK;
-				}
-				prev = &vp->next;
+	struct hashent *hp;
+	struct var *vp;
+
+	HTFOREACH(hp, &vartab) {
+		vp = hp->ent;
+		if ((vp->flags & VEXPORT) == 0) {
+			htdelete(&vartab, hp);
+			if ((vp->flags & VTEXTFIXED) == 0)
+				ckfree(vp->text);
+			freearrays(vp);
+			if ((vp->flags & VSTRFIXED) == 0) {
+				ckfree(vp);
+				vargen++;
+			}
+		} else {
+			if (vp->flags & VSTACK) {
+				vp->text = savestr(vp->text);
+				vp->flags &=~ VSTACK;
 			}
 		}
 	}
+	envdirty = 1;
 	initvar();
 }
 
@@ -419,19 +1500,65 @@ showvarscmd(argc, argv)
 	int argc;
 	char **argv; 
 {
-	struct var **vpp;
+	struct hashent *hp;
 	struct var *vp;
 
-	for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++) {
-		for (vp = *vpp ; vp ; vp = vp->next) {
-			if ((vp->flags & VUNSET) == 0)
-				out1fmt("%s\n", vp->text);
-		}
+	importenv();
+	HTFOREACH(hp, &vartab) {
+		vp = hp->ent;
+		if (vp->flags & VNOTEXT)
+			fmtvar(vp);
+		if (vp->flags & (VARRAY|VASSOC))
+			showarray(vp);
+		else if ((vp->flags & VUNSET) == 0)
+			out1fmt("%s\n", vp->text);
 	}
 	return 0;
 }
 
 
+/*
+ * List an array for showvarscmd as name=(value ...), or as
+ * name=([key]=value ...) for an associative array.
+ */
+
+STATIC void
+showarray(vp)
+	struct var *vp;
+	{
+	struct velem *ep;
+	char *p;
+	char *sep;
+	int i;
+
+	for (p = vp->text ; *p != '=' ; p++)
+		out1c(*p);
+	out1str("=(");
+	sep = "";
+	if (vp->flags & VASSOC) {
+		for (i = 0 ; i < vp->assoc->nkeys ; i++) {
+			if ((ep = vp->assoc->keys[i]) != NULL) {
+				out1fmt("%s[%s]=%s", sep, ep->key, ep->val);
+				sep = " ";
+			}
+		}
+		out1str(")\n");
+		return;
+	}
+	if ((vp->flags & VUNSET) == 0) {
+		out1str(p + 1);
+		sep = " ";
+	}
+	for (i = 1 ; i < vp->array->nvals ; i++) {
+		if (vp->array->vals[i]) {
+			out1fmt("%s%s", sep, vp->array->vals[i]);
+			sep = " ";
+		}
+	}
+	out1str(")\n");
+}
+
+
 
 /*
  * The export and readonly commands.
@@ -442,7 +1569,7 @@ exportcmd(argc, argv)
 	int argc;
 	char **argv; 
 {
-	struct var **vpp;
+	struct hashent *hp;
 	struct var *vp;
 	char *name;
 	char *p;
@@ -453,26 +1580,26 @@ exportcmd(argc, argv)
 		while ((name = *argptr++) != NULL) {
 			if ((p = strchr(name, '=')) != NULL) {
 				p++;
-			} else {
-				vpp = hashvar(name);
-				for (vp = *vpp ; vp ; vp = vp->next) {
-					if (varequal(vp->text, name)) {
-						vp->flags |= flag;
-						goto found;
-					}
-				}
+			} else if ((vp = findvar(name)) != NULL) {
+				INTOFF;
+				savevar(vp);
+				if (flag == VEXPORT)
+					envdirty = 1;
+				vp->flags |= flag;
+				INTON;
+				goto found;
 			}
 			setvar(name, p, flag);
 found:;
 		}
 	} else {
-		for (vpp = vartab ; vpp < vartab + VTABSIZE ; vpp++) {
-			for (vp = *vpp ; vp ; vp = vp->next) {
-				if (vp->flags & flag) {
-					for (p = vp->text ; *p != '=' ; p++)
-						out1c(*p);
-					out1c('\n');
-				}
+		importenv();
+		HTFOREACH(hp, &vartab) {
+			vp = hp->ent;
+			if (vp->flags & flag) {
+				for (p = vp->text ; *p != '=' ; p++)
+					out1c(*p);
+				out1c('\n');
 			}
 		}
 	}
@@ -489,17 +1616,103 @@ localcmd(argc, argv)
 	int argc;
 	char **argv; 
 {
-	char *name;
-
 	if (! in_function())
 		error("Not in a function");
+	return declarecmd(argc, argv);
+}
+
+
+/*
+ * The declare and typeset commands, which local shares.  The -a and -A
+ * options make the variables indexed and associative arrays, and -i
+ * makes them integer variables.  In a function the variables are made
+ * local as well.  An argument name=(word...) or name+=(word...) assigns
+ * the words to the array once it has its attributes.
+ */
+
+int
+declarecmd(argc, argv)
+	int argc;
+	char **argv;
+{
+	char *name;
+	char *p;
+	struct strlist *list;
+	int isarray;
+	int append;
+	int flags;
+	int c;
+
+	flags = 0;
+	while ((c = nextopt("aAi")) != '\0')
+		flags |= c == 'a' ? VARRAY : c == 'A' ? VASSOC : VINTEGER;
+	if ((flags & (VARRAY|VASSOC)) == (VARRAY|VASSOC))
+		error("-a and -A cannot be used together");
+	if (*argptr == NULL)
+		return argv[0][0] == 'l' ? 0 : showvarscmd(argc, argv);
 	while ((name = *argptr++) != NULL) {
-		mklocal(name);
+		isarray = arrayelems(name, &list);
+		append = 0;
+		if ((p = strchr(name, '=')) != NULL) {
+			if (isarray && p[-1] == '+') {
+				append = 1;
+				p[-1] = '\0';
+			}
+			*p = '\0';
+		}
+		if (in_function())
+			mklocal(name);
+		if (flags & VINTEGER)
+			makeint(name);
+		if (p != NULL && ! isarray) {
+			*p = '=';
+			setvareq(savestr(name), 0);
+			*p = '\0';
+		}
+		if (flags & VARRAY)
+			(void)makearray(name);
+		else if (flags & VASSOC)
+			(void)makeassoc(name);
+		if (isarray)
+			setarray(name, list, append);
 	}
 	return 0;
 }
 
 
+/*
+ * Give a variable the integer attribute.  Its value is converted now;
+ * after this, values assigned to it are evaluated as arithmetic.
+ */
+
+STATIC void
+makeint(name)
+	char *name;
+	{
+	struct var *vp;
+	arith_t n;
+	int stale;
+
+	if ((vp = findvar(name)) == NULL) {
+		setvar(name, NULL, VINTEGER);
+		return;
+	}
+	if (vp->flags & VINTEGER)
+		return;
+	if (vp->flags & VREADONLY)
+		error("%s: is read only", name);
+	n = 0;
+	stale = 0;
+	if ((vp->flags & VUNSET) == 0)
+		stale = intval(strchr(vp->text, '=') + 1, &n);
+	INTOFF;
+	savevar(vp);
+	vp->ival = n;
+	vp->flags |= VINTEGER | (stale ? VNOTEXT : 0);
+	INTON;
+}
+
+
 /*
  * Make a variable a local variable.  When a variable is made local, it's
  * value and flags are saved in a localvar structure.  The saved values
@@ -512,7 +1725,6 @@ mklocal(name)
 	char *name;
 	{
 	struct localvar *lvp;
-	struct var **vpp;
 	struct var *vp;
 
 	INTOFF;
@@ -520,21 +1732,26 @@ mklocal(name)
 	if (name[0] == '-' && name[1] == '\0') {
 		lvp->text = ckmalloc(sizeof optlist);
 		memcpy(lvp->text, optlist, sizeof optlist);
+		lvp->array = NULL;
+		lvp->assoc = NULL;
 		vp = NULL;
 	} else {
-		vpp = hashvar(name);
-		for (vp = *vpp ; vp && ! varequal(vp->text, name) ; vp = vp->next);
-		if (vp == NULL) {
+		if ((vp = findvar(name)) == NULL) {
 			if (strchr(name, '='))
 				setvareq(savestr(name), VSTRFIXED);
 			else
 				setvar(name, NULL, VSTRFIXED);
-			vp = *vpp;	/* the new variable */
+			vp = findvar(name);	/* the new variable */
 			lvp->text = NULL;
 			lvp->flags = VUNSET;
+			lvp->array = NULL;
+			lvp->assoc = NULL;
 		} else {
+			savevar(vp);
 			lvp->text = vp->text;
+			lvp->ival = vp->ival;
 			lvp->flags = vp->flags;
+			savearrays(lvp, vp);
 			vp->flags |= VSTRFIXED|VTEXTFIXED;
 			if (strchr(name, '='))
 				setvareq(savestr(name), 0);
@@ -562,16 +1779,124 @@ poplocalvars() {
 		if (vp == NULL) {	/* $- saved */
 			memcpy(optlist, lvp->text, sizeof optlist);
 			ckfree(lvp->text);
-		} else if ((lvp->flags & (VUNSET|VSTRFIXED)) == VUNSET) {
+		} else if (lvp->text == NULL) {	/* created by local */
 			(void)unsetvar(vp->text);
 		} else {
+			if ((vp->flags | lvp->flags) & VEXPORT)
+				envdirty = 1;
 			if ((vp->flags & VTEXTFIXED) == 0)
 				ckfree(vp->text);
+			restorearrays(vp, lvp);
+			vp->flags = lvp->flags;
+			vp->text = lvp->text;
+			vp->ival = lvp->ival;
+		}
+		ckfree(lvp);
+	}
+}
+
+
+/*
+ * Command substitutions which the shell runs itself (see evalbackcmd)
+ * must not change the variables of the shell.  The first time such a
+ * command changes a variable, its old value and flags are saved on
+ * the savedvars list; savevars and restorevars bracket the command.
+ * A variable created by the command is saved with a null text.  Saved
+ * variables are marked VSTRFIXED so that unset leaves them in place.
+ */
+
+STATIC void
+savevar(vp)
+	struct var *vp;
+	{
+	struct localvar *lvp;
+
+	if (backnest == 0 || (vp->flags & VSAVED))
+		return;
+	INTOFF;
+	lvp = ckmalloc(sizeof (struct localvar));
+	lvp->vp = vp;
+	lvp->flags = vp->flags;
+	lvp->text = vp->text;
+	lvp->ival = vp->ival;
+	savearrays(lvp, vp);
+	vp->flags |= VSAVED|VSTRFIXED|VTEXTFIXED;
+	lvp->next = savedvars;
+	savedvars = lvp;
+	INTON;
+}
+
+
+/*
+ * Start saving variables for a command substitution.  Variables saved
+ * for an enclosing substitution have to be saved again.
+ */
+
+struct localvar *
+savevars() {
+	struct localvar *lvp;
+
+	for (lvp = savedvars ; lvp ; lvp = lvp->next)
+		lvp->vp->flags &=~ VSAVED;
+	return savedvars;
+}
+
+
+/*
+ * Put back the variables saved since savevars returned mark.  Local
+ * variables made since the local variable list was locals are simply
+ * forgotten, since restoring the saved values undoes them as well.
+ */
+
+void
+restorevars(mark, locals)
+	struct localvar *mark;
+	struct localvar *locals;
+	{
+	struct localvar *lvp;
+	struct var *vp;
+
+	INTOFF;
+	while ((lvp = localvars) != locals) {
+		localvars = lvp->next;
+		if (lvp->vp == NULL)
+			ckfree(lvp->text);
+		freearray(lvp->array);
+		freeassoc(lvp->assoc);
+		ckfree(lvp);
+	}
+	while ((lvp = savedvars) != mark) {
+		savedvars = lvp->next;
+		vp = lvp->vp;
+		if ((vp->flags | lvp->flags) & VEXPORT)
+			envdirty = 1;
+		if (lvp->text == NULL) {	/* created since */
+			htdelete(&vartab,
+			    htlookup(&vartab, vp->text, hashstr(vp->text)));
+			if ((vp->flags & (VTEXTFIXED|VSTACK)) == 0)
+				ckfree(vp->text);
+			freearrays(vp);
+			ckfree(vp);
+			vargen++;
+		} else {
+			if (vp == &vpath && vp->text != lvp->text)
+				changepath(lvp->text + 5);
+			if ((vp->flags & (VTEXTFIXED|VSTACK)) == 0)
+				ckfree(vp->text);
+			restorearrays(vp, lvp);
 			vp->flags = lvp->flags;
 			vp->text = lvp->text;
+			vp->ival = lvp->ival;
+#ifndef NO_HISTORY
+			if (vp == &vhistsize)
+				sethistsize();
+#endif
 		}
 		ckfree(lvp);
 	}
+	for (lvp = savedvars ; lvp ; lvp = lvp->next)
+		lvp->vp->flags |= VSAVED;
+	INTON;
 }
 
 
@@ -634,49 +1959,173 @@ STATIC int
 unsetvar(s)
 	char *s;
 	{
-	struct var **vpp;
+	struct hashent *hp;
 	struct var *vp;
+	char *p;
+
+	for (p = s ; is_in_name(*p) ; p++);
+	if (*p == '[')
+		return unsetelem(s, p);
+	if ((hp = varslot(s)) == NULL)
+		return (1);
+	vp = hp->ent;
+	if (vp->flags & VREADONLY)
+		return (1);
+	INTOFF;
+	savevar(vp);
+	if (vp->flags & VEXPORT)
+		envdirty = 1;
+	vp->flags &=~ (VINTEGER|VNOTEXT);
+	if (*(strchr(vp->text, '=') + 1) != '\0')
+		setvar(s, nullstr, 0);
+	vp->flags &=~ (VEXPORT|VARRAY|VASSOC);
+	vp->flags |= VUNSET;
+	freearrays(vp);
+	if ((vp->flags & VSTRFIXED) == 0) {
+		htdelete(&vartab, hp);
+		if ((vp->flags & VTEXTFIXED) == 0)
+			ckfree(vp->text);
+		ckfree(vp);
+		vargen++;
+	}
+	INTON;
+	return (0);
+}
+
+
 
-	vpp = hashvar(s);
-	for (vp = *vpp ; vp ; vpp = &vp->next, vp = *vpp) {
-		if (varequal(vp->text, s)) {
-			if (vp->flags & VREADONLY)
-				return (1);
+/*
+ * Unset one element of an array, given as name[subscript].  Unsetting
+ * element 0 of a variable which is not an array unsets the variable.
+ */
+
+STATIC int
+unsetelem(s, p)
+	char *s, *p;
+	{
+	struct var *vp;
+	struct varray *ap;
+	char *q;
+	int index;
+
+	q = p + strlen(p) - 1;
+	if (q <= p || *q != ']')
+		error("%s: bad array subscript", s);
+	*p = '\0';
+	*q = '\0';
+	vp = findvar(s);
+	if (vp != NULL && (vp->flags & VASSOC)) {
+		if (vp->flags & VREADONLY)
+			return (1);
+		if (findkey(vp->assoc, p + 1) != NULL) {
 			INTOFF;
-			if (*(strchr(vp->text, '=') + 1) != '\0')
-				setvar(s, nullstr, 0);
-			vp->flags &=~ VEXPORT;
-			vp->flags |= VUNSET;
-			if ((vp->flags & VSTRFIXED) == 0) {
-				if ((vp->flags & VTEXTFIXED) == 0)
-					ckfree(vp->text);
-				*vpp = vp->next;
-				ckfree(vp);
-			}
+			savevar(vp);	/* may copy the elements */
+			delkey(vp->assoc, findkey(vp->assoc, p + 1));
 			INTON;
-			return (0);
 		}
+		return (0);
+	}
+	index = subindex(p + 1);
+	if (vp == NULL)
+		return (0);
+	if (vp->flags & VREADONLY)
+		return (1);
+	if (index < 0)
+		index += varraysize(vp);
+	if (index == 0) {
+		if (vp->flags & VARRAY)
+			setvar(s, NULL, 0);
+		else
+			return unsetvar(s);
+	} else if ((vp->flags & VARRAY) && index > 0
+		&& index < vp->array->nvals && vp->array->vals[index]) {
+		INTOFF;
+		savevar(vp);
+		ap = vp->array;
+		ckfree(ap->vals[index]);
+		ap->vals[index] = NULL;
+		ap->nset--;
+		while (ap->nvals > 0 && ap->vals[ap->nvals - 1] == NULL)
+			ap->nvals--;
+		INTON;
 	}
+	return (0);
+}
+
+
 
-	return (1);
+/*
+ * Find the slot of a variable from its name, which may be followed by
+ * '='.  A variable still in envtab is moved to vartab first.
+ */
+
+STATIC struct hashent *
+varslot(name)
+	char *name;
+	{
+	struct hashent *hp;
+	struct var *vp;
+	unsigned hash;
+
+	hash = hashstr(name);
+	if ((hp = htlookup(&vartab, name, hash)) != NULL || envtab.nent == 0
+	 || (hp = htlookup(&envtab, name, hash)) == NULL)
+		return hp;
+	INTOFF;
+	vp = ckmalloc(sizeof (*vp));
+	vp->flags = VEXPORT|VTEXTFIXED;
+	vp->text = hp->ent;
+	vp->ival = 0;
+	vp->array = NULL;
+	vp->assoc = NULL;
+	htdelete(&envtab, hp);
+	hp = htadd(&vartab, vp, hash);
+	INTON;
+	return hp;
 }
 
 
+STATIC struct var *
+findvar(name)
+	char *name;
+	{
+	struct hashent *hp;
+
+	if ((hp = varslot(name)) == NULL)
+		return NULL;
+	return hp->ent;
+}
+
 
 /*
- * Find the appropriate entry in the hash table from the name.
+ * Move everything left in envtab to vartab, for the commands which list
+ * the variables.
  */
 
-STATIC struct var **
-hashvar(p)
-	register char *p;
+STATIC void
+importenv() {
+	struct hashent *hp;
+
+	HTFOREACH(hp, &envtab)
+		(void)varslot(hp->ent);
+}
+
+
+STATIC int
+envmatch(ent, name)
+	void *ent;
+	const char *name;
 	{
-	unsigned int hashval;
+	return varequal((char *)ent, (char *)name);
+}
+
 
-	hashval = *p << 4;
-	while (*p && *p != '=')
-		hashval += *p++;
-	return &vartab[hashval % VTABSIZE];
+STATIC int
+varmatch(ent, name)
+	void *ent;
+	const char *name;
+	{
+	return varequal(((struct var *)ent)->text, (char *)name);
 }
 
 
@@ -47,12 +47,44 @@
 #define VTEXTFIXED	010	/* text is staticly allocated */
 #define VSTACK		020	/* text is allocated on the stack */
 #define VUNSET		040	/* the variable is not set */
+#define VSAVED		0100	/* old value saved by savevars */
+#define VARRAY		0200	/* variable is an indexed array */
+#define VASSOC		0400	/* variable is an associative array */
+#define VINTEGER	01000	/* variable holds an integer, in ival */
+#define VNOTEXT		02000	/* value in text is stale; make it from ival */
+
+
+/*
+ * The elements of an indexed array other than element 0, which is the
+ * value of the variable itself.  vals[i] is NULL if element i is unset.
+ */
+
+struct varray {
+	int nvals;		/* highest set index plus one, or 0 */
+	int nset;		/* number of set elements in vals */
+	int size;		/* allocated size of vals */
+	char **vals;		/* the values, indexed directly */
+};
 
 
 struct var {
-	struct var *next;		/* next entry in hash list */
 	int flags;		/* flags are defined above */
 	char *text;		/* name=value */
+	arith_t ival;		/* value if VINTEGER */
+	struct varray *array;	/* elements 1 and up if VARRAY */
+	struct vassoc *assoc;	/* elements if VASSOC */
+};
+
+
+/*
+ * A variable used in arithmetic.  The variable found is remembered,
+ * and is good while vargen is unchanged.
+ */
+
+struct numref {
+	char *name;		/* the name of the variable */
+	struct var *vp;		/* the variable, or NULL */
+	int gen;		/* vargen when vp was found */
 };
 
 
@@ -61,6 +93,9 @@ struct localvar {
 	struct var *vp;		/* the variable that was made local */
 	int flags;		/* saved flags */
 	char *text;		/* saved text */
+	arith_t ival;		/* saved integer value */
+	struct varray *array;	/* saved array */
+	struct vassoc *assoc;	/* saved associative array */
 };
 
 
@@ -106,13 +141,29 @@ void setvareq __P((char *, int));
 struct strlist;
 void listsetvar __P((struct strlist *)); 
 char *lookupvar __P((char *));
+char *lookupvarref __P((char *));
+arith_t getnum __P((struct numref *));
+void setnum __P((struct numref *, arith_t));
+int isassocref __P((struct numref *));
+arith_t getelemnum __P((struct numref *, arith_t, char *));
+void setelemnum __P((struct numref *, arith_t, char *, arith_t));
 char *bltinlookup __P((char *, int));
+void setelem __P((char *, int, char *));
+void setelemeq __P((char *));
+void setarray __P((char *, struct strlist *, int));
+char *lookupsub __P((char *, char *));
+char *nextelem __P((char *, int *, char **));
+int arraycount __P((char *));
 char **environment __P((void));
+char **listenvironment __P((struct strlist *));
 void shprocvar __P((void));
 int showvarscmd __P((int, char **));
 int exportcmd __P((int, char **));
 int localcmd __P((int, char **));
+int declarecmd __P((int, char **));
 void mklocal __P((char *));   
 void poplocalvars __P((void));
+struct localvar *savevars __P((void));
+void restorevars __P((struct localvar *, struct localvar *));
 int setvarcmd __P((int, char **));
 int unsetcmd __P((int, char **));